@@ -0,0 +1,2287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "fitsio.h"
+#include "schedule.h"
+#include "apply.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#define PLANE_ALIGN 64
+
+// Extra ring slots so that several input frames can be batched before
+// their output planes have to be written
+#define BATCH_SLACK 16
+
+// Pool of cache-line aligned output planes.
+// Planes are recycled after being flushed, so steady-state processing does not
+// touch the system allocator. Planes are never returned to the system until
+// pool_destroy(), hence n_allocated is also the high-water mark of live planes.
+typedef struct {
+    size_t plane_bytes;   // Plane size rounded up to PLANE_ALIGN
+    size_t zero_bytes;    // Bytes cleared on acquire (n_pixels * sizeof(float))
+    float **free_planes;  // Stack of planes available for reuse
+    long n_free;
+    long cap_free;
+    long n_allocated;     // Planes obtained from the system
+    long n_acquired;      // Total acquisitions
+    long n_reused;        // Acquisitions served from the free stack
+} PlanePool;
+
+// Ring buffer of in-flight output frames.
+// Output frame k lives in slot k % window. Since the schedule is ordered in
+// time, live frames always fall within [head, head + window), so lookup and
+// retirement are O(1) and frames are flushed in index order.
+typedef struct {
+    long window;    // Number of slots, >= maximum number of frames one input row spans
+    long head;      // Lowest output index not yet flushed
+    long n_pixels;
+    float **slots;  // slots[k % window], NULL if frame k not yet touched
+    PlanePool pool; // Backing storage for the planes in slots
+} OutputRing;
+
+// Print the CFITSIO error stack for a failed call, and pass status through
+static int error_report(int status) {
+    if (status) fits_report_error(stderr, status);
+    return status;
+}
+
+static void pool_init(PlanePool *pool, long n_pixels) {
+    pool->zero_bytes = (size_t)n_pixels * sizeof(float);
+    pool->plane_bytes = (pool->zero_bytes + PLANE_ALIGN - 1) / PLANE_ALIGN * PLANE_ALIGN;
+    pool->free_planes = NULL;
+    pool->n_free = 0;
+    pool->cap_free = 0;
+    pool->n_allocated = 0;
+    pool->n_acquired = 0;
+    pool->n_reused = 0;
+}
+
+// Get a zeroed plane, reusing a released one when available.
+// Returns NULL if out of memory (an error has been printed).
+static float* pool_acquire(PlanePool *pool) {
+    float *plane;
+    if (pool->n_free > 0) {
+        plane = pool->free_planes[--pool->n_free];
+        pool->n_reused++;
+    } else {
+        void *mem = NULL;
+        if (posix_memalign(&mem, PLANE_ALIGN, pool->plane_bytes) != 0) {
+            fprintf(stderr, "Error: could not allocate output plane (%zu bytes)\n", pool->plane_bytes);
+            return NULL;
+        }
+        plane = (float *)mem;
+        pool->n_allocated++;
+    }
+    pool->n_acquired++;
+    memset(plane, 0, pool->zero_bytes);
+    return plane;
+}
+
+static void pool_release(PlanePool *pool, float *plane) {
+    if (pool->n_free == pool->cap_free) {
+        long cap = pool->cap_free ? 2 * pool->cap_free : 16;
+        float **free_planes = (float **)realloc(pool->free_planes, cap * sizeof(float *));
+        if (!free_planes) {
+            // No room to keep it for reuse
+            free(plane);
+            pool->n_allocated--;
+            return;
+        }
+        pool->free_planes = free_planes;
+        pool->cap_free = cap;
+    }
+    pool->free_planes[pool->n_free++] = plane;
+}
+
+static void pool_print_stats(const PlanePool *pool, FILE *f) {
+    double reuse_pct = pool->n_acquired ? 100.0 * pool->n_reused / pool->n_acquired : 0.0;
+    fprintf(f, "Plane pool: %ld planes of %zu bytes allocated (high-water), %ld acquired, %ld reused (%.1f%%)\n",
+             pool->n_allocated, pool->plane_bytes, pool->n_acquired, pool->n_reused, reuse_pct);
+}
+
+// Free all planes; every plane must have been released
+static void pool_destroy(PlanePool *pool) {
+    for (long i = 0; i < pool->n_free; i++) {
+        free(pool->free_planes[i]);
+    }
+    free(pool->free_planes);
+    pool->free_planes = NULL;
+    pool->n_free = 0;
+    pool->cap_free = 0;
+}
+
+// Returns 0 on success, -1 if out of memory (nothing is left to free)
+static int ring_init(OutputRing *ring, long window, long n_pixels) {
+    ring->window = window;
+    ring->head = 0;
+    ring->n_pixels = n_pixels;
+    ring->slots = (float **)calloc(window, sizeof(float *));
+    pool_init(&ring->pool, n_pixels);
+    if (!ring->slots) {
+        fprintf(stderr, "Error: out of memory for the output ring\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void ring_free(OutputRing *ring) {
+    for (long i = 0; i < ring->window; i++) {
+        if (ring->slots[i]) pool_release(&ring->pool, ring->slots[i]);
+    }
+    free(ring->slots);
+    ring->slots = NULL;
+    pool_destroy(&ring->pool);
+}
+
+// Enlarge the window to at least min_window slots, keeping live frames.
+// Returns 0 on success, -1 if out of memory (the ring is unchanged).
+static int ring_grow(OutputRing *ring, long min_window) {
+    long window = 2 * ring->window;
+    if (window < min_window) window = min_window;
+    float **slots = (float **)calloc(window, sizeof(float *));
+    if (!slots) {
+        fprintf(stderr, "Error: out of memory for the output ring\n");
+        return -1;
+    }
+    for (long idx = ring->head; idx < ring->head + ring->window; idx++) {
+        slots[idx % window] = ring->slots[idx % ring->window];
+    }
+    free(ring->slots);
+    ring->slots = slots;
+    ring->window = window;
+    return 0;
+}
+
+// Find or create an output frame buffer
+// *plane is set to NULL if frame idx has already been flushed or lies beyond
+// the window. Returns 0, or -1 if a new plane could not be allocated.
+static int get_output_frame(OutputRing *ring, long idx, float **plane) {
+    *plane = NULL;
+    if (idx < ring->head || idx >= ring->head + ring->window) {
+        return 0;
+    }
+    float **slot = &ring->slots[idx % ring->window];
+    if (*slot == NULL) {
+        *slot = pool_acquire(&ring->pool); // Zero initialized
+        if (*slot == NULL) return -1;
+    }
+    *plane = *slot;
+    return 0;
+}
+
+// Bounded single-producer single-consumer queue of pointers.
+// Slots are exchanged with atomic head/tail indices; the semaphore only puts
+// the consumer to sleep when the queue is empty. Pushes never block: callers
+// size the queue for all items that can be in flight.
+typedef struct {
+    void **slots;
+    unsigned cap;        // Power of two
+    unsigned head;       // Next slot to pop (consumer)
+    unsigned tail;       // Next slot to push (producer)
+    sem_t items;
+} SpscQueue;
+
+// Returns 0 on success, -1 if out of memory
+static int spsc_init(SpscQueue *q, unsigned min_cap) {
+    q->cap = 1;
+    while (q->cap < min_cap) q->cap *= 2;
+    q->slots = (void **)calloc(q->cap, sizeof(void *));
+    if (!q->slots) return -1;
+    q->head = 0;
+    q->tail = 0;
+    sem_init(&q->items, 0, 0);
+    return 0;
+}
+
+static void spsc_destroy(SpscQueue *q) {
+    sem_destroy(&q->items);
+    free(q->slots);
+}
+
+static void spsc_push(SpscQueue *q, void *item) {
+    unsigned tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    q->slots[tail & (q->cap - 1)] = item;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    sem_post(&q->items);
+}
+
+// Pop the next item, waiting if the queue is empty. *stalls is incremented
+// each time the caller had to wait.
+static void* spsc_pop(SpscQueue *q, long *stalls) {
+    if (sem_trywait(&q->items) != 0) {
+        (*stalls)++;
+        while (sem_wait(&q->items) != 0) {
+            // Retry on EINTR
+        }
+    }
+    unsigned head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    void *item = q->slots[head & (q->cap - 1)];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+// Pop the next item if one is available, NULL otherwise
+static void* spsc_try_pop(SpscQueue *q) {
+    if (sem_trywait(&q->items) != 0) return NULL;
+    unsigned head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    void *item = q->slots[head & (q->cap - 1)];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+// A finished output plane on its way to the file
+typedef struct {
+    long idx;
+    float *plane;
+} WriteJob;
+
+// Writes finished planes to the output cube.
+// With a queue depth > 0, planes are handed to a writer thread and come back
+// through a return queue once written; at most depth planes are in flight,
+// so a slow output volume throttles accumulation instead of growing the
+// plane pool without bound. With depth 0 planes are written synchronously.
+typedef struct {
+    fitsfile *fptr;
+    pthread_mutex_t *lock;  // Serializes access to fptr between segment workers (may be NULL)
+    long naxis1;
+    long naxis2;
+    long naxis3;            // Current NAXIS3 of the output cube
+    int grow;               // Extend NAXIS3 when writing beyond it
+    int depth;
+    WriteJob *jobs;         // depth jobs, used round-robin in submission order
+    long n_submitted;
+    long n_returned;
+    SpscQueue pending;      // Accumulator -> writer, NULL marks the end
+    SpscQueue written;      // Writer -> accumulator
+    pthread_t thread;
+    long queue_stalls;      // Accumulator waited for the writer
+    int status;             // First CFITSIO error; later planes are not written
+} OutputWriter;
+
+static void write_plane(OutputWriter *w, long idx, const float *plane) {
+    int status = 0;
+    if (w->status) return;
+
+    // Write this frame to FITS file
+    // FITS 3D cube: NAXIS3 corresponds to time/frame index.
+    // idx is 0-based index. FITS uses 1-based index for planes.
+    // fits_write_subset expects fpixel/lpixel array coordinates.
+
+    long fpixel[3] = {1, 1, idx + 1};
+    long lpixel[3] = {w->naxis1, w->naxis2, idx + 1};
+
+    // We can write the whole plane at once
+    if (w->lock) pthread_mutex_lock(w->lock);
+    if (w->grow && idx >= w->naxis3) {
+        // Output size not known in advance: extend the cube with some
+        // headroom; the final size is set when the file is closed.
+        long naxes[3] = {w->naxis1, w->naxis2, idx + 1 + w->naxis3 / 4};
+        fits_resize_img(w->fptr, FLOAT_IMG, 3, naxes, &status);
+        w->naxis3 = naxes[2];
+    }
+    fits_write_subset(w->fptr, TFLOAT, fpixel, lpixel, (float *)plane, &status);
+    if (w->lock) pthread_mutex_unlock(w->lock);
+    // Also read by the accumulator while the writer thread runs
+    if (error_report(status)) __atomic_store_n(&w->status, status, __ATOMIC_RELAXED);
+}
+
+static void* writer_main(void *arg) {
+    OutputWriter *w = (OutputWriter *)arg;
+    long stalls = 0;
+    WriteJob *job;
+    while ((job = (WriteJob *)spsc_pop(&w->pending, &stalls)) != NULL) {
+        write_plane(w, job->idx, job->plane);
+        spsc_push(&w->written, job);
+    }
+    return NULL;
+}
+
+// Returns 0 on success, -1 if the writer thread could not be set up (an
+// error has been printed)
+static int writer_init(OutputWriter *w, fitsfile *fptr, pthread_mutex_t *lock, long naxis1, long naxis2, long naxis3, int depth) {
+    w->fptr = fptr;
+    w->lock = lock;
+    w->naxis1 = naxis1;
+    w->naxis2 = naxis2;
+    w->naxis3 = naxis3;
+    w->grow = 0;
+    w->depth = depth;
+    w->jobs = NULL;
+    w->n_submitted = 0;
+    w->n_returned = 0;
+    w->queue_stalls = 0;
+    w->status = 0;
+    if (depth == 0) return 0;
+
+    w->jobs = (WriteJob *)calloc(depth, sizeof(WriteJob));
+    if (!w->jobs) {
+        fprintf(stderr, "Error: out of memory for the output queue\n");
+        return -1;
+    }
+    if (spsc_init(&w->pending, depth + 1) != 0) {
+        fprintf(stderr, "Error: out of memory for the output queue\n");
+        free(w->jobs);
+        return -1;
+    }
+    if (spsc_init(&w->written, depth) != 0) {
+        fprintf(stderr, "Error: out of memory for the output queue\n");
+        spsc_destroy(&w->pending);
+        free(w->jobs);
+        return -1;
+    }
+    if (pthread_create(&w->thread, NULL, writer_main, w) != 0) {
+        fprintf(stderr, "Error: could not create writer thread\n");
+        spsc_destroy(&w->pending);
+        spsc_destroy(&w->written);
+        free(w->jobs);
+        return -1;
+    }
+    return 0;
+}
+
+// Recycle a plane the writer is done with
+static void writer_reclaim(OutputWriter *w, OutputRing *ring, WriteJob *job) {
+    pool_release(&ring->pool, job->plane);
+    job->plane = NULL;
+    w->n_returned++;
+}
+
+// Hand a finished plane to the writer. Ownership of the plane passes to the
+// writer until it is returned to the ring's pool.
+static void writer_submit(OutputWriter *w, OutputRing *ring, long idx, float *plane) {
+    if (w->depth == 0) {
+        write_plane(w, idx, plane);
+        pool_release(&ring->pool, plane);
+        return;
+    }
+
+    // Collect planes already written without waiting
+    WriteJob *done;
+    while ((done = (WriteJob *)spsc_try_pop(&w->written)) != NULL) {
+        writer_reclaim(w, ring, done);
+    }
+    // Queue full: wait for the oldest plane to be written
+    if (w->n_submitted - w->n_returned == w->depth) {
+        writer_reclaim(w, ring, (WriteJob *)spsc_pop(&w->written, &w->queue_stalls));
+    }
+
+    // Jobs complete in order, so the next one in the round is free
+    WriteJob *job = &w->jobs[w->n_submitted % w->depth];
+    job->idx = idx;
+    job->plane = plane;
+    w->n_submitted++;
+    spsc_push(&w->pending, job);
+}
+
+// Wait until every submitted plane is written and back in the pool
+static void writer_drain(OutputWriter *w, OutputRing *ring) {
+    long stalls = 0;
+    while (w->n_returned < w->n_submitted) {
+        writer_reclaim(w, ring, (WriteJob *)spsc_pop(&w->written, &stalls));
+    }
+}
+
+// Stop the writer thread; the queue must have been drained
+static void writer_stop(OutputWriter *w) {
+    if (w->depth == 0) return;
+    spsc_push(&w->pending, NULL);
+    pthread_join(w->thread, NULL);
+    spsc_destroy(&w->pending);
+    spsc_destroy(&w->written);
+    free(w->jobs);
+}
+
+// Send output frames that are done (idx < threshold_idx) to the writer
+static void flush_frames(OutputRing *ring, OutputWriter *w, long threshold_idx) {
+    // Only slots within the window can hold live frames
+    long last = ring->head + ring->window;
+    if (threshold_idx < last) last = threshold_idx;
+
+    for (long idx = ring->head; idx < last; idx++) {
+        float **slot = &ring->slots[idx % ring->window];
+        if (*slot == NULL) continue;
+
+        writer_submit(w, ring, idx, *slot);
+        *slot = NULL;
+    }
+
+    if (threshold_idx > ring->head) ring->head = threshold_idx;
+}
+
+typedef enum {
+    PIX_F32,
+    PIX_U8,
+    PIX_I16,
+    PIX_U16,
+    PIX_I32,
+    N_PIX_TYPES
+} PixType;
+
+// Bytes per pixel for each PixType
+static const size_t pix_size[N_PIX_TYPES] = {4, 1, 2, 2, 4};
+
+// Accumulation kernels: out[p] += in[p] * w
+// All variants use a separate multiply and add (no FMA), so results are
+// bit-identical whichever kernel is selected.
+typedef void (*axpy_fn)(float *out, const float *in, float w, long n);
+
+// Fused native-type kernels: out[p] += ((float)in[p] * bscale + bzero) * w
+// Conversion, FITS scaling and overlap weight are applied in a single pass.
+typedef void (*accum_fn)(float *out, const void *in, float bscale, float bzero, float w, long n);
+
+typedef struct {
+    const char *name;
+    axpy_fn axpy;
+    accum_fn accum[N_PIX_TYPES];     // Input in host byte order
+    accum_fn accum_be[N_PIX_TYPES];  // Input in FITS (big-endian) byte order
+} AccumKernels;
+
+// Big-endian to host conversion for data consumed straight from the file
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define BE16(x) (x)
+#define BE32(x) (x)
+#else
+#define BE16(x) __builtin_bswap16(x)
+#define BE32(x) __builtin_bswap32(x)
+#endif
+#define BE8(x) (x)
+
+// The fused kernels are plain loops, compiled once per instruction set and
+// left to the auto-vectorizer.
+#define DEFINE_ACCUM_KERNEL(tag, ctype, isa, attr) \
+    attr static void accum_##tag##_##isa(float *restrict out, const void *restrict vin, \
+                                         float bscale, float bzero, float w, long n) { \
+        const ctype *restrict in = (const ctype *)vin; \
+        for (long p = 0; p < n; p++) { \
+            out[p] += ((float)in[p] * bscale + bzero) * w; \
+        } \
+    }
+
+// Same with a byte swap on load (utype: unsigned type of the same width)
+#define DEFINE_ACCUM_BE_KERNEL(tag, ctype, utype, swap, isa, attr) \
+    attr static void accum_be_##tag##_##isa(float *restrict out, const void *restrict vin, \
+                                            float bscale, float bzero, float w, long n) { \
+        const utype *restrict in = (const utype *)vin; \
+        for (long p = 0; p < n; p++) { \
+            utype u = swap(in[p]); \
+            ctype v; \
+            memcpy(&v, &u, sizeof(v)); \
+            out[p] += ((float)v * bscale + bzero) * w; \
+        } \
+    }
+
+#define DEFINE_ACCUM_KERNELS(isa, attr) \
+    DEFINE_ACCUM_KERNEL(f32, float, isa, attr) \
+    DEFINE_ACCUM_KERNEL(u8, uint8_t, isa, attr) \
+    DEFINE_ACCUM_KERNEL(i16, int16_t, isa, attr) \
+    DEFINE_ACCUM_KERNEL(u16, uint16_t, isa, attr) \
+    DEFINE_ACCUM_KERNEL(i32, int32_t, isa, attr) \
+    DEFINE_ACCUM_BE_KERNEL(f32, float, uint32_t, BE32, isa, attr) \
+    DEFINE_ACCUM_BE_KERNEL(u8, uint8_t, uint8_t, BE8, isa, attr) \
+    DEFINE_ACCUM_BE_KERNEL(i16, int16_t, uint16_t, BE16, isa, attr) \
+    DEFINE_ACCUM_BE_KERNEL(u16, uint16_t, uint16_t, BE16, isa, attr) \
+    DEFINE_ACCUM_BE_KERNEL(i32, int32_t, uint32_t, BE32, isa, attr)
+
+#define ACCUM_KERNELS(isa) \
+    {accum_f32_##isa, accum_u8_##isa, accum_i16_##isa, accum_u16_##isa, accum_i32_##isa}, \
+    {accum_be_f32_##isa, accum_be_u8_##isa, accum_be_i16_##isa, accum_be_u16_##isa, accum_be_i32_##isa}
+
+DEFINE_ACCUM_KERNELS(scalar, )
+
+static void axpy_scalar(float *restrict out, const float *restrict in, float w, long n) {
+    for (long p = 0; p < n; p++) {
+        out[p] += in[p] * w;
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+DEFINE_ACCUM_KERNELS(sse2, __attribute__((target("sse2"))))
+DEFINE_ACCUM_KERNELS(avx2, __attribute__((target("avx2"))))
+DEFINE_ACCUM_KERNELS(avx512, __attribute__((target("avx512f"))))
+
+__attribute__((target("sse2")))
+static void axpy_sse2(float *restrict out, const float *restrict in, float w, long n) {
+    __m128 vw = _mm_set1_ps(w);
+    long p = 0;
+    for (; p + 8 <= n; p += 8) {
+        __m128 a0 = _mm_add_ps(_mm_loadu_ps(out + p), _mm_mul_ps(_mm_loadu_ps(in + p), vw));
+        __m128 a1 = _mm_add_ps(_mm_loadu_ps(out + p + 4), _mm_mul_ps(_mm_loadu_ps(in + p + 4), vw));
+        _mm_storeu_ps(out + p, a0);
+        _mm_storeu_ps(out + p + 4, a1);
+    }
+    for (; p < n; p++) {
+        out[p] += in[p] * w;
+    }
+}
+
+__attribute__((target("avx2")))
+static void axpy_avx2(float *restrict out, const float *restrict in, float w, long n) {
+    __m256 vw = _mm256_set1_ps(w);
+    long p = 0;
+    for (; p + 16 <= n; p += 16) {
+        __m256 a0 = _mm256_add_ps(_mm256_loadu_ps(out + p), _mm256_mul_ps(_mm256_loadu_ps(in + p), vw));
+        __m256 a1 = _mm256_add_ps(_mm256_loadu_ps(out + p + 8), _mm256_mul_ps(_mm256_loadu_ps(in + p + 8), vw));
+        _mm256_storeu_ps(out + p, a0);
+        _mm256_storeu_ps(out + p + 8, a1);
+    }
+    for (; p < n; p++) {
+        out[p] += in[p] * w;
+    }
+}
+
+__attribute__((target("avx512f")))
+static void axpy_avx512(float *restrict out, const float *restrict in, float w, long n) {
+    __m512 vw = _mm512_set1_ps(w);
+    long p = 0;
+    for (; p + 16 <= n; p += 16) {
+        __m512 a = _mm512_add_ps(_mm512_loadu_ps(out + p), _mm512_mul_ps(_mm512_loadu_ps(in + p), vw));
+        _mm512_storeu_ps(out + p, a);
+    }
+    if (p < n) {
+        // Masked tail avoids a scalar remainder loop
+        __mmask16 m = (__mmask16)((1u << (n - p)) - 1);
+        __m512 a = _mm512_add_ps(_mm512_maskz_loadu_ps(m, out + p), _mm512_mul_ps(_mm512_maskz_loadu_ps(m, in + p), vw));
+        _mm512_mask_storeu_ps(out + p, m, a);
+    }
+}
+#endif
+
+static const AccumKernels kernel_table[] = {
+#ifdef HAVE_X86_KERNELS
+    {"avx512", axpy_avx512, ACCUM_KERNELS(avx512)},
+    {"avx2", axpy_avx2, ACCUM_KERNELS(avx2)},
+    {"sse2", axpy_sse2, ACCUM_KERNELS(sse2)},
+#endif
+    {"scalar", axpy_scalar, ACCUM_KERNELS(scalar)},
+};
+#define N_KERNELS (sizeof(kernel_table) / sizeof(kernel_table[0]))
+
+static int kernel_supported(const AccumKernels *k) {
+#ifdef HAVE_X86_KERNELS
+    if (strcmp(k->name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+    if (strcmp(k->name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(k->name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+#endif
+    return 1;
+}
+
+// Pick the widest kernel the CPU supports (cpuid).
+// MILK_RESAMPLE_KERNEL=<name> forces a specific kernel, if supported.
+static const AccumKernels* select_kernels(void) {
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+#endif
+    const char *force = getenv("MILK_RESAMPLE_KERNEL");
+    if (force && force[0]) {
+        for (size_t i = 0; i < N_KERNELS; i++) {
+            if (strcmp(kernel_table[i].name, force) == 0) {
+                if (kernel_supported(&kernel_table[i])) return &kernel_table[i];
+                break;
+            }
+        }
+        fprintf(stderr, "Warning: kernel '%s' unknown or not supported by this CPU, using auto-detection\n", force);
+    }
+    for (size_t i = 0; i < N_KERNELS; i++) {
+        if (kernel_supported(&kernel_table[i])) return &kernel_table[i];
+    }
+    return &kernel_table[N_KERNELS - 1];
+}
+
+// Construct the full path to the FITS file
+// Checks for .fits first, then .fits.fz
+static void get_full_fits_path(char *full_path, const char *teldir, const char *filename, double timestamp) {
+    char base_path[1024];
+
+    if (teldir == NULL) {
+        // Fallback: assume filename or current directory
+        // Need to change extension
+        strcpy(base_path, filename);
+        char *ext = strrchr(base_path, '.');
+        if (ext && strcmp(ext, ".txt") == 0) {
+            strcpy(ext, ".fits");
+        } else {
+            strcat(base_path, ".fits");
+        }
+    } else {
+        // Extract sname from filename (substring before last '_')
+        // Expected filename format: sname_HH:MM:SS.sss.txt
+        char sname[256];
+        const char *last_underscore = strrchr(filename, '_');
+        if (last_underscore) {
+            size_t len = last_underscore - filename;
+            if (len >= sizeof(sname)) len = sizeof(sname) - 1;
+            strncpy(sname, filename, len);
+            sname[len] = '\0';
+        } else {
+            // Unexpected format, fallback to entire filename without extension?
+            // Or assume sname is not present.
+            // Let's assume the user provided just filename if no underscore.
+            strcpy(sname, filename);
+            // remove extension if present
+            char *dot = strrchr(sname, '.');
+            if (dot) *dot = '\0';
+        }
+
+        // Format Date YYYYMMDD from timestamp
+        time_t raw_time = (time_t)timestamp;
+        struct tm tm_info;
+        gmtime_r(&raw_time, &tm_info);
+        char date_str[32];
+        strftime(date_str, sizeof(date_str), "%Y%m%d", &tm_info);
+
+        // Construct path: teldir/YYYYMMDD/sname/filename_with_fits
+        char fname_fits[1024];
+        strcpy(fname_fits, filename);
+        char *ext = strrchr(fname_fits, '.');
+        if (ext && strcmp(ext, ".txt") == 0) {
+            strcpy(ext, ".fits");
+        } else {
+            strcat(fname_fits, ".fits");
+        }
+
+        snprintf(base_path, sizeof(base_path), "%s/%s/%s/%s", teldir, date_str, sname, fname_fits);
+    }
+
+    // Now check existence
+    // 1. Check .fits
+    if (access(base_path, F_OK) == 0) {
+        strcpy(full_path, base_path);
+        return;
+    }
+
+    // 2. Check .fits.fz
+    char fz_path[1050];
+    snprintf(fz_path, sizeof(fz_path), "%s.fz", base_path);
+    if (access(fz_path, F_OK) == 0) {
+        strcpy(full_path, fz_path);
+        return;
+    }
+
+    // Default to base_path if neither found (so error message will refer to .fits)
+    strcpy(full_path, base_path);
+}
+
+static void open_input_fits(fitsfile **infptr, const char *path, int *status) {
+    fits_open_file(infptr, path, READONLY, status);
+    if (*status) return;
+
+    // Check if primary HDU has data. If NAXIS=0, try moving to the first extension.
+    // This handles .fits.fz (fpack) where data is often in the 1st extension.
+    int naxis = 0;
+    fits_get_img_dim(*infptr, &naxis, status);
+    if (*status == 0 && naxis == 0) {
+        // Move to first extension
+        int hdutype;
+        fits_movabs_hdu(*infptr, 2, &hdutype, status);
+        if (*status) {
+            // If error moving, reset status and assume primary was intended but empty
+            // fits_report_error(stderr, *status); // Don't report yet
+            *status = 0;
+            // Go back to primary? No, if move failed, we are likely still at primary.
+            // But if move failed, maybe there are no extensions.
+            // In that case, naxis=0 means no data.
+        }
+    }
+}
+
+// How frames of an input file are read and accumulated
+typedef struct {
+    int datatype;      // CFITSIO datatype passed to fits_read_pix
+    PixType pixtype;   // Matching accumulation kernel
+    float bscale;      // Scaling applied by the kernel
+    float bzero;       // (1 and 0 when CFITSIO applies the scaling itself)
+    int big_endian;    // Frames are raw FITS data (mmap reader), not CFITSIO output
+} InputFormat;
+
+// Choose the native read type for the current HDU.
+// Uncompressed integer images are read raw with CFITSIO scaling disabled, and
+// BSCALE/BZERO are applied by the fused kernel. For tile-compressed images
+// CFITSIO decompresses into the equivalent integer type, which already holds
+// the scaled values. Anything else is read as TFLOAT, as before.
+static void setup_input_format(fitsfile *fptr, InputFormat *fmt, int *status) {
+    fmt->datatype = TFLOAT;
+    fmt->pixtype = PIX_F32;
+    fmt->bscale = 1.0f;
+    fmt->bzero = 0.0f;
+    fmt->big_endian = 0;
+    if (*status) return;
+
+    if (fits_is_compressed_image(fptr, status)) {
+        int equivtype;
+        fits_get_img_equivtype(fptr, &equivtype, status);
+        if (*status) return;
+        switch (equivtype) {
+            case BYTE_IMG:   fmt->datatype = TBYTE;   fmt->pixtype = PIX_U8;  break;
+            case SHORT_IMG:  fmt->datatype = TSHORT;  fmt->pixtype = PIX_I16; break;
+            case USHORT_IMG: fmt->datatype = TUSHORT; fmt->pixtype = PIX_U16; break;
+            case LONG_IMG:   fmt->datatype = TINT;    fmt->pixtype = PIX_I32; break;
+            default: break;
+        }
+        return;
+    }
+
+    int bitpix;
+    fits_get_img_type(fptr, &bitpix, status);
+    if (*status) return;
+    switch (bitpix) {
+        case BYTE_IMG:  fmt->datatype = TBYTE;  fmt->pixtype = PIX_U8;  break;
+        case SHORT_IMG: fmt->datatype = TSHORT; fmt->pixtype = PIX_I16; break;
+        case LONG_IMG:  fmt->datatype = TINT;   fmt->pixtype = PIX_I32; break;
+        case FLOAT_IMG: fmt->datatype = TFLOAT; fmt->pixtype = PIX_F32; break;
+        default: return; // 64-bit types: let CFITSIO convert to float
+    }
+
+    double bscale = 1.0, bzero = 0.0;
+    fits_read_key(fptr, TDOUBLE, "BSCALE", &bscale, NULL, status);
+    if (*status == KEY_NO_EXIST) { *status = 0; bscale = 1.0; }
+    fits_read_key(fptr, TDOUBLE, "BZERO", &bzero, NULL, status);
+    if (*status == KEY_NO_EXIST) { *status = 0; bzero = 0.0; }
+    fits_set_bscale(fptr, 1.0, 0.0, status);
+    fmt->bscale = (float)bscale;
+    fmt->bzero = (float)bzero;
+}
+
+// Accumulate one input frame into an output plane with weight w
+static void accumulate_frame(const AccumKernels *kernels, const InputFormat *fmt, float *out, const void *in, float w, long n_pixels) {
+    if (fmt->big_endian) {
+        kernels->accum_be[fmt->pixtype](out, in, fmt->bscale, fmt->bzero, w, n_pixels);
+    } else if (fmt->pixtype == PIX_F32 && fmt->bscale == 1.0f && fmt->bzero == 0.0f) {
+        kernels->axpy(out, (const float *)in, w, n_pixels);
+    } else {
+        kernels->accum[fmt->pixtype](out, in, fmt->bscale, fmt->bzero, w, n_pixels);
+    }
+}
+
+// One pending contribution: out += in * w over the whole frame
+typedef struct {
+    float *out;
+    const void *in;
+    float w;
+} AccumItem;
+
+// Contributions queued for execution. All items share one input format,
+// since a batch never spans more than one input block.
+typedef struct {
+    InputFormat fmt;
+    AccumItem *items;
+    long n_items;
+    long cap_items;
+} AccumBatch;
+
+// Returns 0 on success, -1 if out of memory
+static int batch_add(AccumBatch *batch, const InputFormat *fmt, float *out, const void *in, float w) {
+    if (batch->n_items == 0) batch->fmt = *fmt;
+    if (batch->n_items == batch->cap_items) {
+        long cap = batch->cap_items ? 2 * batch->cap_items : 256;
+        AccumItem *items = (AccumItem *)realloc(batch->items, cap * sizeof(AccumItem));
+        if (!items) {
+            fprintf(stderr, "Error: out of memory for the accumulation batch\n");
+            return -1;
+        }
+        batch->items = items;
+        batch->cap_items = cap;
+    }
+    AccumItem *it = &batch->items[batch->n_items++];
+    it->out = out;
+    it->in = in;
+    it->w = w;
+    return 0;
+}
+
+// Apply all items of a batch to pixels [p0, p1)
+static void batch_run_stripe(const AccumBatch *batch, const AccumKernels *kernels, long p0, long p1) {
+    if (p1 <= p0) return;
+    size_t in_offset = (size_t)p0 * pix_size[batch->fmt.pixtype];
+    for (long i = 0; i < batch->n_items; i++) {
+        const AccumItem *it = &batch->items[i];
+        accumulate_frame(kernels, &batch->fmt, it->out + p0, (const char *)it->in + in_offset, it->w, p1 - p0);
+    }
+}
+
+// Pixel-partitioned worker pool.
+// Each frame is split into n_threads stripes of whole cache lines; worker i
+// applies every item of the batch to stripe i. Stripes are disjoint, so the
+// workers never touch the same output bytes and need no locking. The calling
+// thread works on stripe 0.
+typedef struct {
+    int n_threads;        // Including the calling thread
+    long n_pixels;
+    long stripe_len;      // Pixels per stripe, multiple of one cache line
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+    long generation;      // Incremented for each batch
+    int n_running;        // Workers still busy on the current batch
+    int shutdown;
+    const AccumBatch *batch;
+    const AccumKernels *kernels;
+} WorkerPool;
+
+typedef struct {
+    WorkerPool *pool;
+    int index;
+} WorkerArg;
+
+static void pool_stripe(const WorkerPool *wp, int i, long *p0, long *p1) {
+    *p0 = i * wp->stripe_len;
+    *p1 = *p0 + wp->stripe_len;
+    if (*p0 > wp->n_pixels) *p0 = wp->n_pixels;
+    if (*p1 > wp->n_pixels) *p1 = wp->n_pixels;
+}
+
+static void* worker_main(void *arg) {
+    WorkerPool *wp = ((WorkerArg *)arg)->pool;
+    int index = ((WorkerArg *)arg)->index;
+    free(arg);
+
+    long seen = 0;
+    pthread_mutex_lock(&wp->lock);
+    for (;;) {
+        while (!wp->shutdown && wp->generation == seen) {
+            pthread_cond_wait(&wp->start_cond, &wp->lock);
+        }
+        if (wp->shutdown) break;
+        seen = wp->generation;
+        pthread_mutex_unlock(&wp->lock);
+
+        long p0, p1;
+        pool_stripe(wp, index, &p0, &p1);
+        batch_run_stripe(wp->batch, wp->kernels, p0, p1);
+
+        pthread_mutex_lock(&wp->lock);
+        if (--wp->n_running == 0) pthread_cond_signal(&wp->done_cond);
+    }
+    pthread_mutex_unlock(&wp->lock);
+    return NULL;
+}
+
+static void workers_destroy(WorkerPool *wp) {
+    pthread_mutex_lock(&wp->lock);
+    wp->shutdown = 1;
+    pthread_cond_broadcast(&wp->start_cond);
+    pthread_mutex_unlock(&wp->lock);
+    for (int i = 1; i < wp->n_threads; i++) {
+        pthread_join(wp->threads[i - 1], NULL);
+    }
+    free(wp->threads);
+    pthread_mutex_destroy(&wp->lock);
+    pthread_cond_destroy(&wp->start_cond);
+    pthread_cond_destroy(&wp->done_cond);
+}
+
+// Returns 0 on success, -1 if the worker threads could not be set up (an
+// error has been printed)
+static int workers_init(WorkerPool *wp, int n_threads, long n_pixels, const AccumKernels *kernels) {
+    const long line = PLANE_ALIGN / sizeof(float);
+
+    wp->n_threads = n_threads;
+    wp->n_pixels = n_pixels;
+    wp->stripe_len = ((n_pixels + n_threads - 1) / n_threads + line - 1) / line * line;
+    wp->generation = 0;
+    wp->n_running = 0;
+    wp->shutdown = 0;
+    wp->batch = NULL;
+    wp->kernels = kernels;
+    wp->threads = NULL;
+    pthread_mutex_init(&wp->lock, NULL);
+    pthread_cond_init(&wp->start_cond, NULL);
+    pthread_cond_init(&wp->done_cond, NULL);
+
+    if (n_threads > 1) {
+        wp->threads = (pthread_t *)malloc((n_threads - 1) * sizeof(pthread_t));
+        if (!wp->threads) {
+            fprintf(stderr, "Error: out of memory for the worker threads\n");
+            wp->n_threads = 1;
+            workers_destroy(wp);
+            return -1;
+        }
+        for (int i = 1; i < n_threads; i++) {
+            WorkerArg *arg = (WorkerArg *)malloc(sizeof(WorkerArg));
+            if (arg) {
+                arg->pool = wp;
+                arg->index = i;
+            }
+            if (!arg || pthread_create(&wp->threads[i - 1], NULL, worker_main, arg) != 0) {
+                fprintf(stderr, "Error: could not create worker thread\n");
+                free(arg);
+                // Stop the workers already running
+                wp->n_threads = i;
+                workers_destroy(wp);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Execute a batch on all workers and wait for completion
+static void workers_run(WorkerPool *wp, const AccumBatch *batch) {
+    if (wp->n_threads == 1) {
+        batch_run_stripe(batch, wp->kernels, 0, wp->n_pixels);
+        return;
+    }
+
+    pthread_mutex_lock(&wp->lock);
+    wp->batch = batch;
+    wp->n_running = wp->n_threads - 1;
+    wp->generation++;
+    pthread_cond_broadcast(&wp->start_cond);
+    pthread_mutex_unlock(&wp->lock);
+
+    long p0, p1;
+    pool_stripe(wp, 0, &p0, &p1);
+    batch_run_stripe(batch, wp->kernels, p0, p1);
+
+    pthread_mutex_lock(&wp->lock);
+    while (wp->n_running > 0) {
+        pthread_cond_wait(&wp->done_cond, &wp->lock);
+    }
+    pthread_mutex_unlock(&wp->lock);
+}
+
+// Settings shared by all segment workers
+typedef struct {
+    const char *resample_file;
+    const ScheduleMap *schedule;  // Mapped binary schedule, NULL for the text format
+    const char *teldir;
+    const char *const *fits_paths;  // FITS cube per file_id of schedule, NULL to look up in teldir
+    fitsfile *outfptr;
+    pthread_mutex_t *out_lock;  // NULL when a single segment runs
+    long naxis1;
+    long naxis2;
+    long naxis3;                // Output frames, 0 if determined while processing
+    long n_pixels;
+    long window;                // Output ring size
+    long block_frames;
+    int prefetch_depth;         // Input blocks read ahead (0: synchronous)
+    int write_depth;            // Output planes queued for the writer (0: synchronous)
+    int use_mmap;
+    int n_threads;              // Pixel stripes per segment
+    const AccumKernels *kernels;
+} ApplyConfig;
+
+// Output side of applyts: output file, ring of in-flight planes and kernels.
+// A Resampler only produces output frames min_out_idx..max_out_idx.
+typedef struct {
+    OutputWriter writer;
+    long n_pixels;
+    long min_out_idx;
+    long max_out_idx;
+    const AccumKernels *kernels;
+    OutputRing ring;
+    AccumBatch batch;   // Contributions not yet applied to their planes
+    WorkerPool workers;
+    long done_idx;      // Output frames below this index receive no more input
+    long n_late;        // Contributions dropped because their frame was already written
+} Resampler;
+
+// Returns 0 on success, -1 if the resampler could not be set up (an error
+// has been printed)
+static int resampler_init(Resampler *rs, const ApplyConfig *cfg, long k_first, long k_last) {
+    if (writer_init(&rs->writer, cfg->outfptr, cfg->out_lock, cfg->naxis1, cfg->naxis2, cfg->naxis3,
+                    cfg->write_depth) != 0) {
+        return -1;
+    }
+    rs->writer.grow = (cfg->naxis3 == 0);
+    rs->n_pixels = cfg->n_pixels;
+    rs->min_out_idx = k_first;
+    rs->max_out_idx = k_last;
+    rs->n_late = 0;
+    rs->done_idx = k_first;
+    memset(&rs->batch, 0, sizeof(rs->batch));
+    rs->kernels = cfg->kernels;
+    if (workers_init(&rs->workers, cfg->n_threads, cfg->n_pixels, rs->kernels) != 0) {
+        writer_stop(&rs->writer);
+        return -1;
+    }
+    if (ring_init(&rs->ring, cfg->window, cfg->n_pixels) != 0) {
+        workers_destroy(&rs->workers);
+        writer_stop(&rs->writer);
+        return -1;
+    }
+    rs->ring.head = k_first;
+    return 0;
+}
+
+// Stop the writer and free; all submitted planes must have been drained
+static void resampler_free(Resampler *rs) {
+    writer_stop(&rs->writer);
+    workers_destroy(&rs->workers);
+    free(rs->batch.items);
+    ring_free(&rs->ring);
+}
+
+// Apply pending contributions, then write out frames that are complete
+static void resampler_flush(Resampler *rs, long threshold_idx) {
+    if (rs->batch.n_items > 0) {
+        workers_run(&rs->workers, &rs->batch);
+        rs->batch.n_items = 0;
+    }
+    flush_frames(&rs->ring, &rs->writer, threshold_idx);
+}
+
+// Distribute one input frame covering [r_start, r_end) over the output frames.
+// The contributions are queued; data must stay valid until resampler_flush().
+// Returns 0 on success, -1 if out of memory.
+static int resampler_add_frame(Resampler *rs, const InputFormat *fmt, const void *data, double r_start, double r_end) {
+    long k_start = (long)floor(r_start);
+    long k_end = (long)floor(r_end - 1e-9);
+
+    if (k_start < rs->min_out_idx) k_start = rs->min_out_idx;
+    // Skip frames beyond the defined output size
+    if (k_end > rs->max_out_idx) k_end = rs->max_out_idx;
+
+    // Frames before k_start are complete. Write them out only when their
+    // ring slots are needed, so that several input frames share one batch.
+    if (k_start > rs->done_idx) rs->done_idx = k_start;
+    if (k_end >= rs->ring.head + rs->ring.window) {
+        resampler_flush(rs, rs->done_idx);
+    }
+    // Wider than any frame seen so far (window not known in advance)
+    if (k_end >= rs->ring.head + rs->ring.window) {
+        if (ring_grow(&rs->ring, k_end - rs->ring.head + 1 + BATCH_SLACK) != 0) return -1;
+    }
+
+    for (long k = k_start; k <= k_end; k++) {
+        // Calculate overlap
+        double o_start = fmax(r_start, (double)k);
+        double o_end = fmin(r_end, (double)(k + 1));
+        double overlap = o_end - o_start;
+
+        if (overlap <= 0) continue;
+
+        float *out_data;
+        if (get_output_frame(&rs->ring, k, &out_data) != 0) return -1;
+        if (!out_data) {
+            // Schedule went backwards into frames already written
+            rs->n_late++;
+            continue;
+        }
+
+        // Add weighted input
+        if (batch_add(&rs->batch, fmt, out_data, data, (float)overlap) != 0) return -1;
+    }
+    return 0;
+}
+
+// In-process resampling: the caller supplies input frames and receives
+// output planes in its own buffers. Contributions are applied before
+// resample_context_add() returns, so the input buffer can be reused at once.
+struct ResampleContext {
+    long n_pixels;
+    long n_output_frames;  // 0 if bounded by the largest r_end instead
+    const AccumKernels *kernels;
+    InputFormat fmt;       // Host-order float frames
+    OutputRing ring;       // ring.head is the next plane to hand out
+    AccumBatch batch;
+    WorkerPool workers;
+    long done_idx;         // Planes below this index receive no more input
+    double max_r_end;
+    int finished;
+    long n_late;
+};
+
+ResampleContext* resample_context_create(long n_pixels, long n_output_frames, int n_threads) {
+    if (n_pixels <= 0 || n_threads < 1) return NULL;
+    ResampleContext *ctx = (ResampleContext *)calloc(1, sizeof(ResampleContext));
+    if (!ctx) return NULL;
+    ctx->n_pixels = n_pixels;
+    ctx->n_output_frames = n_output_frames > 0 ? n_output_frames : 0;
+    ctx->kernels = select_kernels();
+    ctx->fmt.datatype = TFLOAT;
+    ctx->fmt.pixtype = PIX_F32;
+    ctx->fmt.bscale = 1.0f;
+    ctx->fmt.bzero = 0.0f;
+    ctx->fmt.big_endian = 0;
+    if (ring_init(&ctx->ring, BATCH_SLACK, n_pixels) != 0) {
+        free(ctx);
+        return NULL;
+    }
+    if (workers_init(&ctx->workers, n_threads, n_pixels, ctx->kernels) != 0) {
+        ring_free(&ctx->ring);
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+int resample_context_add(ResampleContext *ctx, const float *frame, double r_start, double r_end) {
+    long k_start = (long)floor(r_start);
+    long k_end = (long)floor(r_end - 1e-9);
+    if (k_start < 0) k_start = 0;
+    if (ctx->n_output_frames > 0 && k_end >= ctx->n_output_frames) k_end = ctx->n_output_frames - 1;
+    if (r_end > ctx->max_r_end) ctx->max_r_end = r_end;
+    if (k_start > ctx->done_idx) ctx->done_idx = k_start;
+
+    // Planes not yet taken by the caller stay in the ring
+    if (k_end >= ctx->ring.head + ctx->ring.window) {
+        if (ring_grow(&ctx->ring, k_end - ctx->ring.head + 1 + BATCH_SLACK) != 0) return -1;
+    }
+
+    // On failure, the contributions queued so far are still applied, so
+    // that a plane is either complete or missing this frame entirely
+    int ret = 0;
+    for (long k = k_start; k <= k_end && ret == 0; k++) {
+        double overlap = fmin(r_end, (double)(k + 1)) - fmax(r_start, (double)k);
+        if (overlap <= 0) continue;
+
+        float *out_data;
+        if (get_output_frame(&ctx->ring, k, &out_data) != 0) {
+            ret = -1;
+            break;
+        }
+        if (!out_data) {
+            ctx->n_late++;
+            continue;
+        }
+        ret = batch_add(&ctx->batch, &ctx->fmt, out_data, frame, (float)overlap);
+    }
+    if (ctx->batch.n_items > 0) {
+        workers_run(&ctx->workers, &ctx->batch);
+        ctx->batch.n_items = 0;
+    }
+    return ret;
+}
+
+void resample_context_finish(ResampleContext *ctx) {
+    ctx->finished = 1;
+}
+
+long resample_context_next(ResampleContext *ctx, float *out) {
+    long limit = ctx->done_idx;
+    if (ctx->finished) {
+        // The last partial frame is excluded, as in applyts
+        limit = ctx->n_output_frames > 0 ? ctx->n_output_frames : (long)floor(ctx->max_r_end + 1e-5);
+    } else if (ctx->n_output_frames > 0 && limit > ctx->n_output_frames) {
+        limit = ctx->n_output_frames;
+    }
+
+    OutputRing *ring = &ctx->ring;
+    long idx = ring->head;
+    if (idx >= limit) return -1;
+
+    float **slot = &ring->slots[idx % ring->window];
+    if (*slot) {
+        memcpy(out, *slot, ctx->n_pixels * sizeof(float));
+        pool_release(&ring->pool, *slot);
+        *slot = NULL;
+    } else {
+        // No input frame overlaps this plane
+        memset(out, 0, ctx->n_pixels * sizeof(float));
+    }
+    ring->head++;
+    return idx;
+}
+
+long resample_context_late(const ResampleContext *ctx) {
+    return ctx->n_late;
+}
+
+void resample_context_destroy(ResampleContext *ctx) {
+    if (!ctx) return;
+    workers_destroy(&ctx->workers);
+    free(ctx->batch.items);
+    ring_free(&ctx->ring);
+    free(ctx);
+}
+
+// One input frame of the schedule
+typedef struct {
+    long file_id;     // Entry of the binary schedule's file table, -1 for the text format
+    long l_idx;       // Frame index within the source file (0-based)
+    double t_start;   // Frame start time (Unix sec)
+    double r_start;   // Resampled start time
+    double r_end;     // Resampled end time
+} FrameRow;
+
+// Sequential reader for the resample file, with one row of pushback.
+// Reads either the text format (f) or a mapped binary schedule (map).
+// Rows ending at or before r_min are skipped; the first row starting at or
+// after r_max ends the stream (rows are ordered in time).
+typedef struct {
+    FILE *f;
+    const ScheduleMap *map;
+    long pos;           // Current clock segment of map
+    long pos_frame;     // Next frame within that segment
+    double r_min;
+    double r_max;
+    double max_r_end;   // Largest resampled end time returned so far
+    char line[1024];
+    int has_pending;
+    char pending_fname[1024];
+    FrameRow pending;
+} ScheduleReader;
+
+// Format of resample.txt line:
+// Global_index Start_time End_time Source_filename Local_index Resampled_start Resampled_end
+// %d %.6lf %.6lf %s %d %.6lf %.6lf
+// Returns 0 at end of file
+static int schedule_next_row(ScheduleReader *sr, char *fname, FrameRow *row) {
+    if (sr->has_pending) {
+        sr->has_pending = 0;
+        strcpy(fname, sr->pending_fname);
+        *row = sr->pending;
+        return 1;
+    }
+    if (sr->map) {
+        // Frames are computed from their clock segment, no parsing
+        while (sr->pos < sr->map->hdr->n_clocks) {
+            const ScheduleClock *c = &sr->map->clocks[sr->pos];
+            if (sr->pos_frame >= c->n_frames) {
+                sr->pos++;
+                sr->pos_frame = 0;
+                continue;
+            }
+
+            ScheduleFrame frame;
+            schedule_clock_frame(sr->map, c, sr->pos_frame++, &frame);
+            if (frame.r_end <= sr->r_min) continue;
+            if (frame.r_start >= sr->r_max) return 0;
+
+            strcpy(fname, sr->map->files[c->file_id].name);
+            row->file_id = c->file_id;
+            row->l_idx = frame.l_idx;
+            row->t_start = frame.t_start_ns * 1e-9;
+            row->r_start = frame.r_start;
+            row->r_end = frame.r_end;
+            if (row->r_end > sr->max_r_end) sr->max_r_end = row->r_end;
+            return 1;
+        }
+        return 0;
+    }
+    while (fgets(sr->line, sizeof(sr->line), sr->f)) {
+        if (sr->line[0] == '#') continue;
+
+        int g_idx, l_idx;
+        double t_end;
+
+        int n = sscanf(sr->line, "%d %lf %lf %s %d %lf %lf", &g_idx, &row->t_start, &t_end, fname, &l_idx, &row->r_start, &row->r_end);
+        if (n < 7) continue;
+
+        if (row->r_end <= sr->r_min) continue;
+        if (row->r_start >= sr->r_max) return 0;
+
+        row->file_id = -1;
+        row->l_idx = l_idx;
+        if (row->r_end > sr->max_r_end) sr->max_r_end = row->r_end;
+        return 1;
+    }
+    return 0;
+}
+
+// Summary written by mkts at the top of the resample file
+typedef struct {
+    long n_rows;
+    double max_r_end;
+    double max_span;
+    long naxis1;       // 0 if unknown
+    long naxis2;
+} ScheduleSummary;
+
+// Read the summary from the header lines of the resample file.
+// Returns 0 if a complete summary was found; the file is rewound.
+static int schedule_read_summary(FILE *f, ScheduleSummary *sum) {
+    char line[1024];
+    int found = 0;
+
+    sum->n_rows = -1;
+    sum->naxis1 = 0;
+    sum->naxis2 = 0;
+    while (fgets(line, sizeof(line), f) && line[0] == '#') {
+        if (sscanf(line, "# n_rows: %ld", &sum->n_rows) == 1) found |= 1;
+        if (sscanf(line, "# max_r_end: %lf", &sum->max_r_end) == 1) found |= 2;
+        if (sscanf(line, "# max_span: %lf", &sum->max_span) == 1) found |= 4;
+        sscanf(line, "# naxis: %ld %ld", &sum->naxis1, &sum->naxis2);
+    }
+    rewind(f);
+
+    // n_rows stays -1 if mkts did not complete the file
+    return (found == 7 && sum->n_rows >= 0) ? 0 : 1;
+}
+
+static void schedule_map_summary(const ScheduleMap *m, ScheduleSummary *sum) {
+    sum->n_rows = m->hdr->n_rows;
+    sum->max_r_end = m->hdr->max_r_end;
+    sum->max_span = m->hdr->max_span;
+    sum->naxis1 = m->hdr->naxis1;
+    sum->naxis2 = m->hdr->naxis2;
+}
+
+// Position the reader close before the first row ending after r_target,
+// by bisection on byte offsets. Returns 0 on success.
+static int schedule_seek(ScheduleReader *sr, double r_target) {
+    if (sr->map) {
+        // Bisect on the clock segments (by the end of their last frame),
+        // then on the frames of the segment
+        const ScheduleClock *clocks = sr->map->clocks;
+        ScheduleFrame frame;
+        long lo = 0;
+        long hi = sr->map->hdr->n_clocks;
+        while (lo < hi) {
+            long mid = lo + (hi - lo) / 2;
+            schedule_clock_frame(sr->map, &clocks[mid], clocks[mid].n_frames - 1, &frame);
+            if (frame.r_end <= r_target) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        sr->pos = lo;
+        sr->pos_frame = 0;
+        if (lo < sr->map->hdr->n_clocks) {
+            long j_lo = 0;
+            long j_hi = clocks[lo].n_frames - 1;
+            while (j_lo < j_hi) {
+                long mid = j_lo + (j_hi - j_lo) / 2;
+                schedule_clock_frame(sr->map, &clocks[lo], mid, &frame);
+                if (frame.r_end <= r_target) {
+                    j_lo = mid + 1;
+                } else {
+                    j_hi = mid;
+                }
+            }
+            sr->pos_frame = j_lo;
+        }
+        sr->has_pending = 0;
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fileno(sr->f), &st) != 0) return 1;
+
+    // Invariant: the first row starting at or after lo ends at or before r_target
+    off_t lo = 0;
+    off_t hi = st.st_size;
+    while (hi - lo > 4096) {
+        off_t mid = lo + (hi - lo) / 2;
+        if (fseeko(sr->f, mid - 1, SEEK_SET) != 0) return 1;
+        // Move to the start of the next line
+        if (!fgets(sr->line, sizeof(sr->line), sr->f)) {
+            hi = mid;
+            continue;
+        }
+
+        int found = 0;
+        double r_end = 0.0;
+        while (fgets(sr->line, sizeof(sr->line), sr->f)) {
+            if (sr->line[0] == '#') continue;
+            int g_idx, l_idx;
+            double t_start, t_end, r_start;
+            char fname[1024];
+            if (sscanf(sr->line, "%d %lf %lf %s %d %lf %lf", &g_idx, &t_start, &t_end, fname, &l_idx, &r_start, &r_end) < 7) continue;
+            found = 1;
+            break;
+        }
+        if (found && r_end <= r_target) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (fseeko(sr->f, lo > 0 ? lo - 1 : 0, SEEK_SET) != 0) return 1;
+    if (lo > 0 && !fgets(sr->line, sizeof(sr->line), sr->f)) return 1;
+    sr->has_pending = 0;
+    return 0;
+}
+
+static void schedule_unread_row(ScheduleReader *sr, const char *fname, const FrameRow *row) {
+    strcpy(sr->pending_fname, fname);
+    sr->pending = *row;
+    sr->has_pending = 1;
+}
+
+// Run of consecutive frames of one source file
+typedef struct {
+    char fname[1024];
+    long n_rows;
+    long max_rows;
+    FrameRow *rows;
+} FrameBlock;
+
+// Group the next schedule rows into a block of consecutive local frame indices
+// from the same file, up to max_rows. Returns 0 at end of schedule.
+static int schedule_next_block(ScheduleReader *sr, FrameBlock *blk) {
+    char fname[1024];
+    FrameRow row;
+
+    blk->n_rows = 0;
+    if (!schedule_next_row(sr, blk->fname, &blk->rows[0])) return 0;
+    blk->n_rows = 1;
+
+    while (blk->n_rows < blk->max_rows && schedule_next_row(sr, fname, &row)) {
+        if (strcmp(fname, blk->fname) != 0 || row.l_idx != blk->rows[blk->n_rows - 1].l_idx + 1) {
+            schedule_unread_row(sr, fname, &row);
+            break;
+        }
+        blk->rows[blk->n_rows++] = row;
+    }
+    return 1;
+}
+
+// Read-only mapping of an input file, shared by the reader and the blocks
+// that point into it. Unmapped when the last reference is dropped.
+typedef struct {
+    unsigned char *base;
+    size_t len;
+    int refs;
+} MappedFile;
+
+static void mapped_ref(MappedFile *m) {
+    __atomic_add_fetch(&m->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void mapped_unref(MappedFile *m) {
+    if (__atomic_sub_fetch(&m->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        munmap(m->base, m->len);
+        free(m);
+    }
+}
+
+// Input frames of one block, decoded and ready for accumulation
+typedef struct {
+    FrameBlock blk;
+    InputFormat fmt;
+    void *slab;            // Frames read through CFITSIO, in native type
+    const void **frames;   // frames[i]: data of row i, NULL if it could not be read
+    MappedFile *map;       // Mapping the frames point into, if any (one reference held)
+} InputBlock;
+
+// Currently open input cube.
+// Uncompressed cubes are memory-mapped: frames are then consumed directly
+// from the mapping, and fptr is not used.
+typedef struct {
+    char name[1024];   // Source filename from the schedule, "" if none open
+    fitsfile *fptr;
+    InputFormat fmt;
+    long n_pixels;
+    int use_mmap;      // Try to map uncompressed cubes
+    MappedFile *map;   // Whole-file mapping, NULL if reading through CFITSIO
+    size_t data_offset;  // Start of the data unit within the mapping
+    size_t frame_bytes;
+    long n_frames;       // NAXIS3 of the mapped cube
+    long n_files_mapped;
+    long n_files_cfitsio;
+} InputReader;
+
+static void input_close(InputReader *in) {
+    int status = 0;
+    if (in->fptr) {
+        fits_close_file(in->fptr, &status);
+        in->fptr = NULL;
+    }
+    if (in->map) {
+        mapped_unref(in->map);
+        in->map = NULL;
+    }
+    strcpy(in->name, "");
+}
+
+// Map the data unit of the current HDU if it is a plain uncompressed cube
+// with the expected frame size. The data offset comes from CFITSIO.
+// Returns 0 if mapped; otherwise the caller keeps using CFITSIO.
+static int input_try_mmap(InputReader *in, const char *path) {
+    int status = 0;
+
+    if (fits_is_compressed_image(in->fptr, &status) || status) return 1;
+    if (in->fmt.datatype == TFLOAT && in->fmt.pixtype == PIX_F32) {
+        // TFLOAT is also the fallback for 64-bit types; only map real floats
+        int bitpix;
+        fits_get_img_type(in->fptr, &bitpix, &status);
+        if (status || bitpix != FLOAT_IMG) return 1;
+    }
+
+    int naxis;
+    long naxes[3] = {1, 1, 1};
+    LONGLONG headstart, datastart, dataend;
+    fits_get_img_dim(in->fptr, &naxis, &status);
+    fits_get_img_size(in->fptr, 3, naxes, &status);
+    fits_get_hduaddrll(in->fptr, &headstart, &datastart, &dataend, &status);
+    if (status || naxis < 2 || naxis > 3) return 1;
+    if (naxes[0] * naxes[1] != in->n_pixels) return 1;
+    if (naxis == 2) naxes[2] = 1;
+
+    size_t frame_bytes = (size_t)in->n_pixels * pix_size[in->fmt.pixtype];
+    size_t data_end = (size_t)datastart + frame_bytes * naxes[2];
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < data_end) {
+        close(fd);
+        return 1;
+    }
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return 1;
+    madvise(base, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    in->map = (MappedFile *)malloc(sizeof(MappedFile));
+    if (!in->map) {
+        munmap(base, (size_t)st.st_size);
+        return 1;
+    }
+    in->map->base = (unsigned char *)base;
+    in->map->len = (size_t)st.st_size;
+    in->map->refs = 1;
+    in->data_offset = (size_t)datastart;
+    in->frame_bytes = frame_bytes;
+    in->n_frames = naxes[2];
+    in->fmt.big_endian = 1;
+
+    // Mapping stays valid after the CFITSIO handle is closed
+    fits_close_file(in->fptr, &status);
+    in->fptr = NULL;
+    return 0;
+}
+
+// Make sure the FITS cube for schedule filename fname is open.
+// fits_path is its location if known, otherwise it is looked up in teldir.
+// Returns 0 on success.
+static int input_open(InputReader *in, const char *fname, const char *fits_path, const char *teldir, double timestamp) {
+    int status = 0;
+
+    if ((in->fptr || in->map) && strcmp(fname, in->name) == 0) return 0;
+
+    input_close(in);
+
+    char full_path[1024];
+    if (fits_path) {
+        snprintf(full_path, sizeof(full_path), "%s", fits_path);
+    } else {
+        get_full_fits_path(full_path, teldir, fname, timestamp);
+    }
+
+    open_input_fits(&in->fptr, full_path, &status);
+    if (status) {
+        fprintf(stderr, "Warning: Could not open %s. Skipping frame.\n", full_path);
+        in->fptr = NULL;
+        return 1;
+    }
+    setup_input_format(in->fptr, &in->fmt, &status);
+    if (status) {
+        fprintf(stderr, "Warning: Could not determine data type of %s. Skipping frame.\n", full_path);
+        status = 0;
+        fits_close_file(in->fptr, &status);
+        in->fptr = NULL;
+        return 1;
+    }
+    if (in->use_mmap && input_try_mmap(in, full_path) == 0) {
+        in->n_files_mapped++;
+    } else {
+        in->n_files_cfitsio++;
+    }
+    strcpy(in->name, fname);
+    return 0;
+}
+
+// Read all frames of a block into its slab with a single CFITSIO call.
+// If that fails (e.g. a frame beyond NAXIS3), fall back to frame-by-frame
+// reads so that only the bad frames are skipped. Mapped files are not read
+// at all: the block just points into the mapping.
+static void input_read_block(InputReader *in, InputBlock *b) {
+    const FrameBlock *blk = &b->blk;
+    int status = 0;
+    int anynul;
+
+    b->fmt = in->fmt;
+
+    if (in->map) {
+        mapped_ref(in->map);
+        b->map = in->map;
+        for (long i = 0; i < blk->n_rows; i++) {
+            long l_idx = blk->rows[i].l_idx;
+            if (l_idx >= 0 && l_idx < in->n_frames) {
+                b->frames[i] = in->map->base + in->data_offset + (size_t)l_idx * in->frame_bytes;
+            } else {
+                b->frames[i] = NULL;
+                fprintf(stderr, "Error reading frame %ld from %s\n", l_idx, in->name);
+            }
+        }
+        return;
+    }
+
+    size_t frame_bytes = (size_t)in->n_pixels * pix_size[in->fmt.pixtype];
+    for (long i = 0; i < blk->n_rows; i++) {
+        b->frames[i] = (const char *)b->slab + i * frame_bytes;
+    }
+
+    // l_idx is 0-based in .txt file (assuming mkts output), FITS is 1-based.
+    long fpixel[3] = {1, 1, blk->rows[0].l_idx + 1};
+    fits_read_pix(in->fptr, in->fmt.datatype, fpixel, (LONGLONG)blk->n_rows * in->n_pixels, NULL, b->slab, &anynul, &status);
+    if (status == 0) return;
+
+    for (long i = 0; i < blk->n_rows; i++) {
+        status = 0;
+        fpixel[2] = blk->rows[i].l_idx + 1;
+        fits_read_pix(in->fptr, in->fmt.datatype, fpixel, in->n_pixels, NULL, (void *)b->frames[i], &anynul, &status);
+        if (status) {
+            b->frames[i] = NULL;
+            fprintf(stderr, "Error reading frame %ld from %s\n", blk->rows[i].l_idx, in->name);
+        }
+    }
+}
+
+// Input side of a segment: schedule reader and input files.
+// With a queue depth > 0, a reader thread runs ahead of the accumulator,
+// reading and decoding up to depth blocks (and opening the next source file
+// before the current one is consumed). Blocks circulate between a free
+// queue and a filled queue. With depth 0 blocks are read synchronously.
+typedef struct {
+    ScheduleReader sr;
+    InputReader in;
+    const char *teldir;
+    const char *const *fits_paths;  // FITS cube per file_id, NULL to look up in teldir
+    int depth;
+    InputBlock *blocks;    // max(depth, 1) blocks
+    SpscQueue filled;      // Reader -> accumulator, NULL marks the end
+    SpscQueue free_blocks; // Accumulator -> reader
+    pthread_t thread;
+    long reader_stalls;    // Reader waited for a free block
+    long consumer_stalls;  // Accumulator waited for a filled block
+    int cancel;            // Stop reading: the output can no longer be written
+} Prefetcher;
+
+// Read the next block of the schedule. Returns 0 at end of schedule.
+static int prefetch_fill(Prefetcher *pf, InputBlock *b) {
+    while (!__atomic_load_n(&pf->cancel, __ATOMIC_RELAXED) && schedule_next_block(&pf->sr, &b->blk)) {
+        // Check if we need to open a new file
+        const FrameRow *first = &b->blk.rows[0];
+        const char *fits_path = (pf->fits_paths && first->file_id >= 0) ? pf->fits_paths[first->file_id] : NULL;
+        if (pf->fits_paths && !fits_path) continue;
+        if (input_open(&pf->in, b->blk.fname, fits_path, pf->teldir, first->t_start) != 0) continue;
+
+        input_read_block(&pf->in, b);
+        return 1;
+    }
+    return 0;
+}
+
+static void* prefetch_main(void *arg) {
+    Prefetcher *pf = (Prefetcher *)arg;
+    for (;;) {
+        InputBlock *b = (InputBlock *)spsc_pop(&pf->free_blocks, &pf->reader_stalls);
+        if (!prefetch_fill(pf, b)) break;
+        spsc_push(&pf->filled, b);
+    }
+    spsc_push(&pf->filled, NULL);
+    return NULL;
+}
+
+// Free the input blocks
+static void prefetch_free_blocks(Prefetcher *pf) {
+    int n_blocks = pf->depth > 0 ? pf->depth : 1;
+    for (int i = 0; pf->blocks && i < n_blocks; i++) {
+        if (pf->blocks[i].map) mapped_unref(pf->blocks[i].map);
+        free(pf->blocks[i].blk.rows);
+        free(pf->blocks[i].frames);
+        free(pf->blocks[i].slab);
+    }
+    free(pf->blocks);
+    pf->blocks = NULL;
+}
+
+// Returns 0 on success, -1 if the buffers or the reader thread could not be
+// set up (an error has been printed; nothing is left to free)
+static int prefetch_start(Prefetcher *pf, int depth, long block_frames, long n_pixels) {
+    pf->depth = depth;
+    pf->reader_stalls = 0;
+    pf->consumer_stalls = 0;
+
+    int n_blocks = depth > 0 ? depth : 1;
+    pf->blocks = (InputBlock *)calloc(n_blocks, sizeof(InputBlock));
+    if (!pf->blocks) {
+        fprintf(stderr, "Error: could not allocate input buffer\n");
+        return -1;
+    }
+    for (int i = 0; i < n_blocks; i++) {
+        InputBlock *b = &pf->blocks[i];
+        b->blk.max_rows = block_frames;
+        b->blk.rows = (FrameRow *)malloc(block_frames * sizeof(FrameRow));
+        b->frames = (const void **)malloc(block_frames * sizeof(void *));
+        // Slab sized for the widest native type (4 bytes)
+        if (!b->blk.rows || !b->frames ||
+            posix_memalign(&b->slab, PLANE_ALIGN, (size_t)block_frames * n_pixels * sizeof(float)) != 0) {
+            b->slab = NULL;
+            fprintf(stderr, "Error: could not allocate input buffer\n");
+            prefetch_free_blocks(pf);
+            return -1;
+        }
+    }
+
+    if (depth > 0) {
+        if (spsc_init(&pf->filled, depth + 1) != 0) {
+            fprintf(stderr, "Error: could not allocate input queue\n");
+            prefetch_free_blocks(pf);
+            return -1;
+        }
+        if (spsc_init(&pf->free_blocks, depth) != 0) {
+            fprintf(stderr, "Error: could not allocate input queue\n");
+            spsc_destroy(&pf->filled);
+            prefetch_free_blocks(pf);
+            return -1;
+        }
+        for (int i = 0; i < depth; i++) {
+            spsc_push(&pf->free_blocks, &pf->blocks[i]);
+        }
+        if (pthread_create(&pf->thread, NULL, prefetch_main, pf) != 0) {
+            fprintf(stderr, "Error: could not create reader thread\n");
+            spsc_destroy(&pf->filled);
+            spsc_destroy(&pf->free_blocks);
+            prefetch_free_blocks(pf);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Next decoded block, or NULL at end of schedule
+static InputBlock* prefetch_next(Prefetcher *pf) {
+    if (pf->depth == 0) {
+        return prefetch_fill(pf, &pf->blocks[0]) ? &pf->blocks[0] : NULL;
+    }
+    return (InputBlock *)spsc_pop(&pf->filled, &pf->consumer_stalls);
+}
+
+// Hand a consumed block back to the reader
+static void prefetch_release(Prefetcher *pf, InputBlock *b) {
+    if (b->map) {
+        mapped_unref(b->map);
+        b->map = NULL;
+    }
+    if (pf->depth > 0) spsc_push(&pf->free_blocks, b);
+}
+
+// Make the reader stop at the next block and discard the blocks it queued
+static void prefetch_cancel(Prefetcher *pf) {
+    __atomic_store_n(&pf->cancel, 1, __ATOMIC_RELAXED);
+    if (pf->depth == 0) return;
+    InputBlock *b;
+    while ((b = (InputBlock *)spsc_pop(&pf->filled, &pf->consumer_stalls)) != NULL) {
+        prefetch_release(pf, b);
+    }
+}
+
+// Wait for the reader thread (which must have reached the end) and free
+static void prefetch_stop(Prefetcher *pf) {
+    if (pf->depth > 0) {
+        pthread_join(pf->thread, NULL);
+        spsc_destroy(&pf->filled);
+        spsc_destroy(&pf->free_blocks);
+    }
+    prefetch_free_blocks(pf);
+    input_close(&pf->in);
+}
+
+// Contiguous range of output frames processed by one worker, with its own
+// schedule reader, input handles and output ring. Output frames are only
+// produced by the segment that owns them: input frames straddling a
+// boundary are read by both segments, each adding its share of the overlap.
+typedef struct {
+    const ApplyConfig *cfg;
+    long k_first;            // First output frame of the segment
+    long k_last;             // Last output frame of the segment
+    // Results
+    int status;              // 0, a CFITSIO status, or 1 for other errors
+    long n_late;
+    long n_files_mapped;
+    long n_files_cfitsio;
+    long reader_stalls;
+    long consumer_stalls;
+    long writer_stalls;
+    double max_r_end;        // Largest resampled end time seen
+    PlanePool pool_stats;
+} Segment;
+
+static void* process_segment(void *arg) {
+    Segment *seg = (Segment *)arg;
+    const ApplyConfig *cfg = seg->cfg;
+
+    Prefetcher pf;
+    memset(&pf, 0, sizeof(pf));
+    pf.teldir = cfg->teldir;
+    pf.fits_paths = cfg->fits_paths;
+    pf.in.n_pixels = cfg->n_pixels;
+    pf.in.use_mmap = cfg->use_mmap;
+
+    ScheduleReader *sr = &pf.sr;
+    if (cfg->schedule) {
+        // Binary schedule mapped once, shared by all segments
+        sr->map = cfg->schedule;
+    } else {
+        sr->f = fopen(cfg->resample_file, "r");
+        if (!sr->f) {
+            fprintf(stderr, "Error opening %s\n", cfg->resample_file);
+            seg->status = 1;
+            return NULL;
+        }
+    }
+    sr->r_min = (double)seg->k_first;
+    sr->r_max = (double)(seg->k_last + 1);
+    if (seg->k_first > 0 && schedule_seek(sr, sr->r_min) != 0) {
+        rewind(sr->f);
+    }
+
+    Resampler rs;
+    if (resampler_init(&rs, cfg, seg->k_first, seg->k_last) != 0) {
+        seg->status = 1;
+        if (sr->f) fclose(sr->f);
+        return NULL;
+    }
+    if (prefetch_start(&pf, cfg->prefetch_depth, cfg->block_frames, cfg->n_pixels) != 0) {
+        seg->status = 1;
+        resampler_free(&rs);
+        if (sr->f) fclose(sr->f);
+        return NULL;
+    }
+
+    InputBlock *b;
+    while ((b = prefetch_next(&pf)) != NULL) {
+        if (__atomic_load_n(&rs.writer.status, __ATOMIC_RELAXED)) {
+            // Output failed: no point in reading the rest of the input
+            prefetch_release(&pf, b);
+            prefetch_cancel(&pf);
+            break;
+        }
+        for (long i = 0; i < b->blk.n_rows && !seg->status; i++) {
+            if (!b->frames[i]) continue;
+            if (resampler_add_frame(&rs, &b->fmt, b->frames[i], b->blk.rows[i].r_start, b->blk.rows[i].r_end) != 0) {
+                seg->status = 1;
+            }
+        }
+        if (seg->status) {
+            // Out of memory: drop the contributions pointing into the block
+            rs.batch.n_items = 0;
+            prefetch_release(&pf, b);
+            prefetch_cancel(&pf);
+            break;
+        }
+        // The block's buffer is reused once released
+        resampler_flush(&rs, rs.done_idx);
+        prefetch_release(&pf, b);
+    }
+
+    // Flush remaining
+    if (!seg->status) resampler_flush(&rs, LONG_MAX);
+    writer_drain(&rs.writer, &rs.ring);
+    seg->pool_stats = rs.ring.pool;
+    resampler_free(&rs);
+
+    seg->n_late = rs.n_late;
+    seg->n_files_mapped = pf.in.n_files_mapped;
+    seg->n_files_cfitsio = pf.in.n_files_cfitsio;
+    seg->reader_stalls = pf.reader_stalls;
+    seg->consumer_stalls = pf.consumer_stalls;
+    seg->writer_stalls = rs.writer.queue_stalls;
+    if (!seg->status) seg->status = rs.writer.status;
+
+    prefetch_stop(&pf);
+    seg->max_r_end = sr->max_r_end;
+    if (sr->f) fclose(sr->f);
+    return NULL;
+}
+
+void apply_default_options(ApplyOptions *opt) {
+    opt->block_frames = 0;
+    opt->use_mmap = 1;
+    opt->n_threads = 1;
+    opt->n_segments = 1;
+    opt->prefetch_depth = DEFAULT_PREFETCH_DEPTH;
+    opt->write_depth = DEFAULT_WRITE_DEPTH;
+    opt->log = NULL;
+}
+
+int apply_parse_option(ApplyOptions *opt, int c, const char *arg) {
+    switch (c) {
+        case 'b':
+            opt->block_frames = atol(arg);
+            if (opt->block_frames < 1) {
+                fprintf(stderr, "Invalid block size: %s\n", arg);
+                return 1;
+            }
+            return 0;
+        case 't':
+            opt->n_threads = atoi(arg);
+            if (opt->n_threads < 1) {
+                fprintf(stderr, "Invalid number of threads: %s\n", arg);
+                return 1;
+            }
+            return 0;
+        case 's':
+            opt->n_segments = atoi(arg);
+            if (opt->n_segments < 1) {
+                fprintf(stderr, "Invalid number of segments: %s\n", arg);
+                return 1;
+            }
+            return 0;
+        case 'p':
+            opt->prefetch_depth = atoi(arg);
+            if (opt->prefetch_depth < 0) {
+                fprintf(stderr, "Invalid prefetch depth: %s\n", arg);
+                return 1;
+            }
+            return 0;
+        case 'w':
+            opt->write_depth = atoi(arg);
+            if (opt->write_depth < 0) {
+                fprintf(stderr, "Invalid write queue depth: %s\n", arg);
+                return 1;
+            }
+            return 0;
+        case 'M':
+            opt->use_mmap = 0;
+            return 0;
+    }
+    return -1;
+}
+
+void apply_print_options(FILE *f) {
+    fprintf(f, "  -b, --block N   read up to N consecutive input frames per call (default: up to %d, %d MB slab)\n",
+            DEFAULT_BLOCK_FRAMES, DEFAULT_SLAB_MB);
+    fprintf(f, "  -p, --prefetch N read up to N input blocks ahead in a reader thread (0: no reader thread, default: %d)\n",
+            DEFAULT_PREFETCH_DEPTH);
+    fprintf(f, "  -w, --write-queue N queue up to N finished planes for a writer thread (0: no writer thread, default: %d)\n",
+            DEFAULT_WRITE_DEPTH);
+    fprintf(f, "      --no-mmap   always read through CFITSIO, do not map uncompressed cubes\n");
+    fprintf(f, "  -t, --threads N accumulate with N threads, each owning a stripe of pixels (default: 1)\n");
+    fprintf(f, "  -s, --segments K split the output frames into K time segments processed in parallel (default: 1)\n");
+}
+
+// Resample into out_filename. cfg holds the schedule source (schedule,
+// resample_file, teldir, fits_paths); the rest is filled in here.
+// sum is the schedule summary, NULL if there is none (single pass).
+// Returns 0 on success, otherwise a CFITSIO status or 1.
+static int apply_run(ApplyConfig *cfg, const ScheduleSummary *sum, const char *out_filename, const ApplyOptions *opt) {
+    const char *resample_file = cfg->resample_file ? cfg->resample_file : "schedule";
+    int single_pass = (sum == NULL);
+    FILE *log = opt->log;
+    long block_frames = opt->block_frames;
+    int n_segments = opt->n_segments;
+
+    long n_output_frames = 0;
+    long naxis1 = 0;
+    long naxis2 = 0;
+    if (!single_pass) {
+        // Calculate number of frames.
+        // We strictly use the floor of max_r_end (plus a small epsilon for FP noise).
+        // This excludes the last partial frame.
+        // E.g., if max_r_end is 10.2, we want 10 frames (indices 0..9).
+        // If max_r_end is 10.0, we want 10 frames (indices 0..9).
+        n_output_frames = (long)floor(sum->max_r_end + 1e-5);
+
+        if (n_output_frames <= 0) {
+            fprintf(stderr, "No valid data found in %s or empty output range\n", resample_file);
+            return 1;
+        }
+        naxis1 = sum->naxis1;
+        naxis2 = sum->naxis2;
+    } else if (log) {
+        fprintf(log, "No summary in %s, output size determined in a single pass\n", resample_file);
+    }
+
+    int status = 0;
+    if (naxis1 <= 0 || naxis2 <= 0) {
+        // Frame size not recorded: open the FITS file of the first row
+        ScheduleReader sr;
+        memset(&sr, 0, sizeof(sr));
+        sr.map = cfg->schedule;
+        if (!sr.map) {
+            sr.f = fopen(cfg->resample_file, "r");
+            if (!sr.f) {
+                fprintf(stderr, "Error opening %s\n", cfg->resample_file);
+                return 1;
+            }
+        }
+        sr.r_min = -HUGE_VAL;
+        sr.r_max = HUGE_VAL;
+
+        char fname[1024];
+        FrameRow row;
+        int found = schedule_next_row(&sr, fname, &row);
+        if (sr.f) fclose(sr.f);
+        if (!found) {
+            fprintf(stderr, "No valid data found in %s or empty output range\n", resample_file);
+            return 1;
+        }
+
+        char first_fits_file_path[1024];
+        if (cfg->fits_paths && row.file_id >= 0 && cfg->fits_paths[row.file_id]) {
+            snprintf(first_fits_file_path, sizeof(first_fits_file_path), "%s", cfg->fits_paths[row.file_id]);
+        } else {
+            get_full_fits_path(first_fits_file_path, cfg->teldir, fname, row.t_start);
+        }
+
+        fitsfile *infptr;
+        open_input_fits(&infptr, first_fits_file_path, &status);
+        if (status) {
+            fprintf(stderr, "Error opening first FITS file %s\n", first_fits_file_path);
+            fits_report_error(stderr, status);
+            return 1;
+        }
+
+        int naxis;
+        long naxes[3];
+        fits_get_img_dim(infptr, &naxis, &status);
+        fits_get_img_size(infptr, 3, naxes, &status);
+        fits_close_file(infptr, &status);
+        if (error_report(status)) return status;
+
+        if (naxis < 2) {
+            fprintf(stderr, "Input FITS file must have at least 2 dimensions\n");
+            return 1;
+        }
+        naxis1 = naxes[0];
+        naxis2 = naxes[1];
+    }
+
+    long n_pixels = naxis1 * naxis2;
+
+    if (!single_pass && log) {
+        fprintf(log, "Output Dimensions: %ld x %ld x %ld (frames)\n", naxis1, naxis2, n_output_frames);
+    }
+
+    if (block_frames == 0) {
+        long frame_bytes = n_pixels * (long)sizeof(float);
+        block_frames = (DEFAULT_SLAB_MB * 1024L * 1024L) / frame_bytes;
+        if (block_frames > DEFAULT_BLOCK_FRAMES) block_frames = DEFAULT_BLOCK_FRAMES;
+        if (block_frames < 1) block_frames = 1;
+    }
+
+    // Delete if exists
+    remove(out_filename);
+
+    fitsfile *outfptr;
+    fits_create_file(&outfptr, out_filename, &status);
+    if (error_report(status)) return status;
+
+    // In a single pass, the cube starts empty and grows as frames are written
+    long out_naxes[3] = {naxis1, naxis2, n_output_frames};
+    fits_create_img(outfptr, FLOAT_IMG, 3, out_naxes, &status);
+    if (error_report(status)) {
+        int del_status = 0;
+        fits_delete_file(outfptr, &del_status);
+        return status;
+    }
+
+    cfg->outfptr = outfptr;
+    cfg->out_lock = NULL;
+    cfg->naxis1 = naxis1;
+    cfg->naxis2 = naxis2;
+    cfg->naxis3 = n_output_frames;
+    cfg->n_pixels = n_pixels;
+    // An input frame touches at most ceil(max_span) + 1 output frames.
+    // Without a summary the ring starts small and grows as needed.
+    cfg->window = (single_pass ? 0 : (long)ceil(sum->max_span)) + 2 + BATCH_SLACK;
+    cfg->block_frames = block_frames;
+    cfg->prefetch_depth = opt->prefetch_depth;
+    cfg->write_depth = opt->write_depth;
+    cfg->use_mmap = opt->use_mmap;
+    cfg->n_threads = opt->n_threads;
+    cfg->kernels = select_kernels();
+
+    // CFITSIO handles may only be used from several threads in a reentrant build
+    if (cfg->prefetch_depth > 0 && !fits_is_reentrant()) {
+        fprintf(stderr, "Warning: CFITSIO is not built reentrant (--enable-reentrant), reading input without prefetch\n");
+        cfg->prefetch_depth = 0;
+    }
+    if (cfg->write_depth > 0 && !fits_is_reentrant()) {
+        fprintf(stderr, "Warning: CFITSIO is not built reentrant (--enable-reentrant), writing output without a writer thread\n");
+        cfg->write_depth = 0;
+    }
+    if (log) {
+        fprintf(log, "Accumulation kernel: %s\n", cfg->kernels->name);
+        fprintf(log, "Accumulation threads: %d\n", opt->n_threads);
+        fprintf(log, "Input block: up to %ld frames per read, %d blocks read ahead\n", block_frames, cfg->prefetch_depth);
+        fprintf(log, "Output queue: up to %d planes queued for writing\n", cfg->write_depth);
+    }
+
+    if (n_segments > 1 && !fits_is_reentrant()) {
+        fprintf(stderr, "Warning: CFITSIO is not built reentrant (--enable-reentrant), processing as a single segment\n");
+        n_segments = 1;
+    }
+    if (n_segments > 1 && single_pass) {
+        fprintf(stderr, "Warning: output size unknown (no summary in %s), processing as a single segment\n", resample_file);
+        n_segments = 1;
+    }
+    if (!single_pass && n_segments > n_output_frames) n_segments = (int)n_output_frames;
+
+    pthread_mutex_t out_lock;
+    pthread_mutex_init(&out_lock, NULL);
+    if (n_segments > 1) cfg->out_lock = &out_lock;
+
+    // Split the output range into contiguous segments
+    Segment *segs = (Segment *)calloc(n_segments, sizeof(Segment));
+    if (!segs) {
+        fprintf(stderr, "Error: out of memory for the time segments\n");
+        pthread_mutex_destroy(&out_lock);
+        fits_close_file(outfptr, &status);
+        return 1;
+    }
+    for (int i = 0; i < n_segments; i++) {
+        segs[i].cfg = cfg;
+        if (single_pass) {
+            segs[i].k_first = 0;
+            segs[i].k_last = LONG_MAX - 1;
+        } else {
+            segs[i].k_first = n_output_frames * i / n_segments;
+            segs[i].k_last = n_output_frames * (i + 1) / n_segments - 1;
+        }
+    }
+
+    if (n_segments == 1) {
+        process_segment(&segs[0]);
+    } else {
+        if (log) fprintf(log, "Time segments: %d\n", n_segments);
+        pthread_t *seg_threads = (pthread_t *)malloc(n_segments * sizeof(pthread_t));
+        int n_started = 0;
+        for (; seg_threads && n_started < n_segments; n_started++) {
+            if (pthread_create(&seg_threads[n_started], NULL, process_segment, &segs[n_started]) != 0) break;
+        }
+        if (n_started < n_segments) {
+            fprintf(stderr, "Error: could not create segment thread\n");
+            for (int i = n_started; i < n_segments; i++) segs[i].status = 1;
+        }
+        for (int i = 0; i < n_started; i++) {
+            pthread_join(seg_threads[i], NULL);
+        }
+        free(seg_threads);
+    }
+
+    // Combine per-segment statistics
+    int seg_status = 0;
+    double max_r_end = 0.0;
+    long n_late = 0, n_files_mapped = 0, n_files_cfitsio = 0;
+    long reader_stalls = 0, consumer_stalls = 0, writer_stalls = 0;
+    PlanePool pool_stats;
+    memset(&pool_stats, 0, sizeof(pool_stats));
+    pool_stats.plane_bytes = segs[0].pool_stats.plane_bytes;
+    for (int i = 0; i < n_segments; i++) {
+        if (segs[i].status && !seg_status) seg_status = segs[i].status;
+        if (segs[i].max_r_end > max_r_end) max_r_end = segs[i].max_r_end;
+        n_late += segs[i].n_late;
+        n_files_mapped += segs[i].n_files_mapped;
+        n_files_cfitsio += segs[i].n_files_cfitsio;
+        reader_stalls += segs[i].reader_stalls;
+        consumer_stalls += segs[i].consumer_stalls;
+        writer_stalls += segs[i].writer_stalls;
+        pool_stats.n_allocated += segs[i].pool_stats.n_allocated;
+        pool_stats.n_acquired += segs[i].pool_stats.n_acquired;
+        pool_stats.n_reused += segs[i].pool_stats.n_reused;
+    }
+    free(segs);
+    pthread_mutex_destroy(&out_lock);
+
+    if (log) {
+        pool_print_stats(&pool_stats, log);
+        fprintf(log, "Input files: %ld memory-mapped, %ld read through CFITSIO\n", n_files_mapped, n_files_cfitsio);
+        if (cfg->prefetch_depth > 0) {
+            fprintf(log, "Prefetch stalls: reader waited %ld times for a free block, accumulator waited %ld times for input\n",
+                    reader_stalls, consumer_stalls);
+        }
+        if (cfg->write_depth > 0) {
+            fprintf(log, "Writer stalls: accumulator waited %ld times for the output queue\n", writer_stalls);
+        }
+    }
+
+    if (n_late > 0) {
+        fprintf(stderr, "Warning: %ld contributions to already written output frames were dropped (schedule not time-ordered)\n", n_late);
+    }
+
+    if (seg_status) {
+        fprintf(stderr, "Error: resampling failed, %s is incomplete\n", out_filename);
+        int close_status = 0;
+        fits_close_file(outfptr, &close_status);
+        return seg_status;
+    }
+
+    if (single_pass) {
+        // Now that all rows are known, trim the cube to its final size
+        // (whole output frames only, as for a schedule with a summary)
+        n_output_frames = (long)floor(max_r_end + 1e-5);
+        if (n_output_frames <= 0) {
+            fprintf(stderr, "No valid data found in %s or empty output range\n", resample_file);
+            fits_delete_file(outfptr, &status);
+            return 1;
+        }
+        long final_naxes[3] = {naxis1, naxis2, n_output_frames};
+        fits_resize_img(outfptr, FLOAT_IMG, 3, final_naxes, &status);
+        if (error_report(status)) {
+            int close_status = 0;
+            fits_close_file(outfptr, &close_status);
+            return status;
+        }
+        if (log) fprintf(log, "Output Dimensions: %ld x %ld x %ld (frames)\n", naxis1, naxis2, n_output_frames);
+    }
+
+    // Buffered data is written on close
+    fits_close_file(outfptr, &status);
+    return error_report(status);
+}
+
+int apply_resample_file(const char *resample_file, const char *teldir, const char *out_filename,
+                        const ApplyOptions *opt) {
+    ApplyConfig cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.resample_file = resample_file;
+    cfg.teldir = teldir;
+
+    // Binary schedules are mapped and carry their summary in the header
+    ScheduleMap sched;
+    int sched_status = schedule_map_open(&sched, resample_file);
+    if (sched_status < 0) return 1;
+    if (sched_status == 0) {
+        cfg.schedule = &sched;
+        ScheduleSummary sum;
+        schedule_map_summary(&sched, &sum);
+        if (opt->log) {
+            fprintf(opt->log, "Schedule: %ld frames in %ld clock segments\n", sum.n_rows, (long)sched.hdr->n_clocks);
+        }
+        int ret = apply_run(&cfg, &sum, out_filename, opt);
+        schedule_map_close(&sched);
+        return ret;
+    }
+
+    FILE *f = fopen(resample_file, "r");
+    if (!f) {
+        fprintf(stderr, "Error opening %s\n", resample_file);
+        return 1;
+    }
+
+    // Output size and ring size come from the summary written by mkts.
+    // Without it (older schedules), the output cube is grown while
+    // processing and its final size is set at the end.
+    ScheduleSummary sum;
+    int have_summary = (schedule_read_summary(f, &sum) == 0);
+    fclose(f);
+    return apply_run(&cfg, have_summary ? &sum : NULL, out_filename, opt);
+}
+
+int apply_resample_map(const ScheduleMap *sched, const char *const *fits_paths, const char *out_filename,
+                       const ApplyOptions *opt) {
+    ApplyConfig cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.schedule = sched;
+    cfg.fits_paths = fits_paths;
+
+    ScheduleSummary sum;
+    schedule_map_summary(sched, &sum);
+    if (opt->log) {
+        fprintf(opt->log, "Schedule: %ld frames in %ld clock segments\n", sum.n_rows, (long)sched->hdr->n_clocks);
+    }
+    return apply_run(&cfg, &sum, out_filename, opt);
+}
@@ -0,0 +1,96 @@
+#ifndef MILK_RESAMPLE_APPLY_H
+#define MILK_RESAMPLE_APPLY_H
+
+#include <stdio.h>
+#include "schedule.h"
+#include "milkresample_export.h"
+
+// Resampling engine: applies a schedule to the FITS cubes it refers to and
+// writes the resampled cube. Used by applyts (schedule read from a file) and
+// by the one-shot resample tool (schedule built in memory).
+
+// Default input block: up to DEFAULT_BLOCK_FRAMES frames, capped at DEFAULT_SLAB_MB
+#define DEFAULT_BLOCK_FRAMES 64
+#define DEFAULT_SLAB_MB 16
+
+// Default number of input blocks the reader thread may run ahead
+#define DEFAULT_PREFETCH_DEPTH 2
+
+// Default number of finished output planes queued for the writer thread
+#define DEFAULT_WRITE_DEPTH 4
+
+typedef struct {
+    long block_frames;    // Frames per input read, 0: pick from frame size
+    int use_mmap;         // Map uncompressed cubes
+    int n_threads;        // Pixel stripes per segment
+    int n_segments;       // Time segments processed in parallel
+    int prefetch_depth;   // Input blocks read ahead (0: synchronous)
+    int write_depth;      // Output planes queued for the writer (0: synchronous)
+    FILE *log;            // Settings and statistics of the run (NULL: none)
+} ApplyOptions;
+
+// Short options handled by apply_parse_option(), for getopt
+#define APPLY_SHORT_OPTIONS "b:t:s:p:w:"
+
+// Long options handled by apply_parse_option(), for getopt_long tables
+#define APPLY_LONG_OPTIONS \
+    {"block", required_argument, 0, 'b'}, \
+    {"no-mmap", no_argument, 0, 'M'}, \
+    {"threads", required_argument, 0, 't'}, \
+    {"segments", required_argument, 0, 's'}, \
+    {"prefetch", required_argument, 0, 'p'}, \
+    {"write-queue", required_argument, 0, 'w'}
+
+// Defaults; log is NULL, so nothing but errors and warnings is printed
+MILKRESAMPLE_API void apply_default_options(ApplyOptions *opt);
+
+// Handle one getopt option. Returns 0 if handled, 1 if its argument is
+// invalid (an error has been printed), -1 if it is not an engine option.
+MILKRESAMPLE_API int apply_parse_option(ApplyOptions *opt, int c, const char *arg);
+
+// Describe the engine options (for usage messages)
+MILKRESAMPLE_API void apply_print_options(FILE *f);
+
+// Resample with the schedule in resample_file (binary or text format).
+// FITS cubes are looked up in teldir (NULL: current directory).
+// Returns 0 on success, otherwise the CFITSIO status of the failed call, or 1
+// for other errors; the error has been printed to stderr.
+MILKRESAMPLE_API int apply_resample_file(const char *resample_file, const char *teldir, const char *out_filename,
+                        const ApplyOptions *opt);
+
+// Resample with a mapped or in-memory binary schedule. fits_paths[file_id]
+// is the FITS cube of each entry of the file table (NULL entries are
+// skipped). Returns 0 on success, or an error as for apply_resample_file().
+MILKRESAMPLE_API int apply_resample_map(const ScheduleMap *sched, const char *const *fits_paths, const char *out_filename,
+                       const ApplyOptions *opt);
+
+// Streaming resampler for in-process use, independent of FITS files.
+// Input frames are host-order floats of n_pixels, added in schedule order
+// with their resampled times; completed output planes are copied out in
+// index order into buffers of n_pixels floats. Contexts share no state, so
+// several may be used from different threads.
+typedef struct ResampleContext ResampleContext;
+
+// n_output_frames limits the output (0: up to the largest r_end, excluding
+// the last partial frame). n_threads accumulates pixel stripes in parallel.
+// Returns NULL on invalid arguments or allocation failure.
+MILKRESAMPLE_API ResampleContext* resample_context_create(long n_pixels, long n_output_frames, int n_threads);
+
+// Distribute one input frame covering [r_start, r_end) over the output
+// frames. frame is not referenced after the call returns. Returns 0, or -1
+// if out of memory: the frame is then missing from some output planes.
+MILKRESAMPLE_API int resample_context_add(ResampleContext *ctx, const float *frame, double r_start, double r_end);
+
+// No more input: all remaining planes become available
+MILKRESAMPLE_API void resample_context_finish(ResampleContext *ctx);
+
+// Copy the next completed output plane into out. Returns its index, or -1
+// if no plane is complete yet (or all have been returned after finish).
+MILKRESAMPLE_API long resample_context_next(ResampleContext *ctx, float *out);
+
+// Contributions dropped because their plane had already been returned
+MILKRESAMPLE_API long resample_context_late(const ResampleContext *ctx);
+
+MILKRESAMPLE_API void resample_context_destroy(ResampleContext *ctx);
+
+#endif
@@ -0,0 +1,421 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include "catalog.h"
+#include "dayindex.h"
+#include "telemetry.h"
+
+void catalog_init(FileCatalog *cat) {
+    memset(cat, 0, sizeof(*cat));
+}
+
+void catalog_free(FileCatalog *cat) {
+    free(cat->arena);
+    free(cat->dirs);
+    free(cat->files);
+    memset(cat, 0, sizeof(*cat));
+}
+
+// Copy a string into the arena, storing its offset in *off.
+// Returns 0, or 1 if the arena cannot grow (an error has been printed).
+static int arena_add(FileCatalog *cat, const char *str, uint32_t *off) {
+    size_t len = strlen(str) + 1;
+    if (cat->arena_len + len > UINT32_MAX) {
+        fprintf(stderr, "Error: file catalog too large\n");
+        return 1;
+    }
+    if (cat->arena_len + len > cat->arena_cap) {
+        size_t cap = cat->arena_cap ? 2 * cat->arena_cap : 65536;
+        while (cap < cat->arena_len + len) cap *= 2;
+        char *arena = (char *)realloc(cat->arena, cap);
+        if (!arena) {
+            fprintf(stderr, "Error: out of memory for the file catalog\n");
+            return 1;
+        }
+        cat->arena = arena;
+        cat->arena_cap = cap;
+    }
+    *off = (uint32_t)cat->arena_len;
+    memcpy(cat->arena + *off, str, len);
+    cat->arena_len += len;
+    return 0;
+}
+
+int catalog_add_dir(FileCatalog *cat, const char *path) {
+    if (cat->n_dirs == cat->cap_dirs) {
+        int cap = cat->cap_dirs ? 2 * cat->cap_dirs : 16;
+        uint32_t *dirs = (uint32_t *)realloc(cat->dirs, cap * sizeof(uint32_t));
+        if (!dirs) {
+            fprintf(stderr, "Error: out of memory for the file catalog\n");
+            return -1;
+        }
+        cat->dirs = dirs;
+        cat->cap_dirs = cap;
+    }
+    if (arena_add(cat, path, &cat->dirs[cat->n_dirs]) != 0) return -1;
+    return cat->n_dirs++;
+}
+
+FileEntry *catalog_add_file(FileCatalog *cat, int dir, const char *name, double tstart) {
+    if (cat->count == cat->cap_files) {
+        int cap = cat->cap_files ? 2 * cat->cap_files : 1024;
+        FileEntry *files = (FileEntry *)realloc(cat->files, cap * sizeof(FileEntry));
+        if (!files) {
+            fprintf(stderr, "Error: out of memory for the file catalog\n");
+            return NULL;
+        }
+        cat->files = files;
+        cat->cap_files = cap;
+    }
+    uint32_t name_off;
+    if (arena_add(cat, name, &name_off) != 0) return NULL;
+    FileEntry *e = &cat->files[cat->count++];
+    e->tstart = tstart;
+    e->dir = (uint32_t)dir;
+    e->name = name_off;
+    e->first_ns = 0;
+    e->last_ns = 0;
+    e->n_frames = -1;
+    return e;
+}
+
+static int compare_files(const void *a, const void *b) {
+    const FileEntry *fa = (const FileEntry *)a;
+    const FileEntry *fb = (const FileEntry *)b;
+    if (fa->tstart < fb->tstart) return -1;
+    if (fa->tstart > fb->tstart) return 1;
+    return 0;
+}
+
+void catalog_sort(FileCatalog *cat) {
+    qsort(cat->files, cat->count, sizeof(FileEntry), compare_files);
+}
+
+void catalog_keep(FileCatalog *cat, int first, int n) {
+    if (first > 0 && n > 0) memmove(cat->files, cat->files + first, n * sizeof(FileEntry));
+    cat->count = n;
+}
+
+const char *catalog_name(const FileCatalog *cat, int i) {
+    return cat->arena + cat->files[i].name;
+}
+
+int catalog_path(const FileCatalog *cat, int i, char *path, size_t size) {
+    const FileEntry *e = &cat->files[i];
+    int n = snprintf(path, size, "%s/%s", cat->arena + cat->dirs[e->dir], cat->arena + e->name);
+    return (n < 0 || (size_t)n >= size) ? 1 : 0;
+}
+
+// One day directory of a scan, and the files of it that the filter of the
+// scan may keep, found by binary search in its index: from the two last
+// files starting at or before tstart up to tend. They form a run
+// [first, end) ordered by start time.
+typedef struct ScanDay {
+    char dirpath[MAX_PATH];
+    time_t day;
+    DayIndex idx;
+    int listed;
+    long first;
+    long end;
+    int cat_dir;            // Index of dirpath in the catalog being filled, -1 if not added yet
+} ScanDay;
+
+typedef struct {
+    const char *sname;
+    double tstart;
+    double tend;
+    int use_index;
+    FILE *log;
+    ScanDay *days;
+    int n_days;
+    int next;               // Next day to claim
+} ScanJob;
+
+static void *scan_worker(void *arg) {
+    ScanJob *job = (ScanJob *)arg;
+    for (;;) {
+        int k = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (k >= job->n_days) break;
+        ScanDay *day = &job->days[k];
+        int ret = job->use_index ? day_index_open(&day->idx, day->dirpath, job->sname, (double)day->day, job->log)
+                                 : day_index_list(&day->idx, day->dirpath, job->sname, (double)day->day);
+        if (ret != 0) continue;
+        day->listed = 1;
+        day->first = day_index_count_until(&day->idx, job->tstart) - 2;
+        if (day->first < 0) day->first = 0;
+        day->end = day_index_count_until(&day->idx, job->tend);
+        if (day->first > day->end) day->first = day->end;
+    }
+    return NULL;
+}
+
+// List days concurrently; the calling thread is one of the workers
+static void scan_days(ScanStream *s, ScanDay *days, int n_days) {
+    ScanJob job = {s->sname, s->tstart, s->tend, s->use_index, s->log, days, n_days, 0};
+    int n_extra = s->n_threads - 1;
+    if (n_extra > n_days - 1) n_extra = n_days - 1;
+    pthread_t *threads = NULL;
+    int n_started = 0;
+    if (n_extra > 0) {
+        threads = (pthread_t *)malloc(n_extra * sizeof(pthread_t));
+        for (; threads && n_started < n_extra; n_started++) {
+            if (pthread_create(&threads[n_started], NULL, scan_worker, &job) != 0) break;
+        }
+    }
+    scan_worker(&job);
+    for (int t = 0; t < n_started; t++) pthread_join(threads[t], NULL);
+    free(threads);
+}
+
+// Run k comes before run j at their current heads (earlier day on ties)
+static int run_before(const ScanDay *days, int k, int j) {
+    double tk = days[k].idx.files[days[k].first].tstart;
+    double tj = days[j].idx.files[days[j].first].tstart;
+    return tk < tj || (tk == tj && k < j);
+}
+
+static void heap_sift_down(int *heap, int n, int i, const ScanDay *days) {
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= n) break;
+        if (c + 1 < n && run_before(days, heap[c + 1], heap[c])) c++;
+        if (!run_before(days, heap[c], heap[i])) break;
+        int tmp = heap[i];
+        heap[i] = heap[c];
+        heap[c] = tmp;
+        i = c;
+    }
+}
+
+// Add a file with its summary from a day index. Returns 0 on success.
+static int add_indexed_file(FileCatalog *cat, int dir, const DayIndex *idx, const DayIndexEntry *e) {
+    FileEntry *f = catalog_add_file(cat, dir, idx->names + e->name, e->tstart);
+    if (!f) return 1;
+    f->first_ns = e->first_ns;
+    f->last_ns = e->last_ns;
+    f->n_frames = e->n_frames;
+    return 0;
+}
+
+// Copy file i of src, with its summary, to the end of dst. Returns 0 on
+// success.
+static int copy_file(FileCatalog *dst, const FileCatalog *src, int i) {
+    const FileEntry *e = &src->files[i];
+    const char *dirpath = src->arena + src->dirs[e->dir];
+    // Files come a directory at a time: reuse the last one
+    int dir = dst->n_dirs - 1;
+    if (dir < 0 || strcmp(dst->arena + dst->dirs[dir], dirpath) != 0) {
+        dir = catalog_add_dir(dst, dirpath);
+        if (dir < 0) return 1;
+    }
+    FileEntry *f = catalog_add_file(dst, dir, src->arena + e->name, e->tstart);
+    if (!f) return 1;
+    f->first_ns = e->first_ns;
+    f->last_ns = e->last_ns;
+    f->n_frames = e->n_frames;
+    return 0;
+}
+
+// Move the files held back to cat. Returns their number, or -1 on error.
+static int release_held(ScanStream *s, FileCatalog *cat) {
+    int n = s->held.count;
+    for (int i = 0; i < n; i++) {
+        if (copy_file(cat, &s->held, i) != 0) return -1;
+    }
+    catalog_free(&s->held);
+    return n;
+}
+
+// Pass on the next file of the merged runs. Files starting at or before
+// tstart are held back until the first one after it: only the last two are
+// kept, the one live at tstart and its predecessor for continuity.
+// Returns the number of files added to cat, or -1 on error.
+static int deliver_file(ScanStream *s, FileCatalog *cat, ScanDay *day, const DayIndexEntry *e) {
+    int added = 0;
+    if (!s->past_tstart) {
+        if (e->tstart <= s->tstart) {
+            if (s->held.count == 2) {
+                FileCatalog held;
+                catalog_init(&held);
+                if (copy_file(&held, &s->held, 1) != 0) {
+                    catalog_free(&held);
+                    return -1;
+                }
+                catalog_free(&s->held);
+                s->held = held;
+            }
+            int dir = catalog_add_dir(&s->held, day->dirpath);
+            if (dir < 0 || add_indexed_file(&s->held, dir, &day->idx, e) != 0) return -1;
+            return 0;
+        }
+        added = release_held(s, cat);
+        if (added < 0) return -1;
+        s->past_tstart = 1;
+    }
+    if (day->cat_dir < 0) day->cat_dir = catalog_add_dir(cat, day->dirpath);
+    if (day->cat_dir < 0 || add_indexed_file(cat, day->cat_dir, &day->idx, e) != 0) return -1;
+    return added + 1;
+}
+
+// Deliver the files of the listed days that start before limit, merging
+// the runs of the days with a heap. Returns the number of files added, or
+// -1 on error.
+static int deliver_until(ScanStream *s, FileCatalog *cat, double limit) {
+    ScanDay *days = s->days;
+    int *heap = (int *)malloc((s->n_days > 0 ? s->n_days : 1) * sizeof(int));
+    if (!heap) {
+        fprintf(stderr, "Error: out of memory for the scan\n");
+        return -1;
+    }
+    int n = 0;
+    for (int k = 0; k < s->n_days; k++) {
+        days[k].cat_dir = -1;
+        if (days[k].first < days[k].end) heap[n++] = k;
+    }
+    for (int i = n / 2 - 1; i >= 0; i--) heap_sift_down(heap, n, i, days);
+
+    int added = 0;
+    while (n > 0) {
+        ScanDay *day = &days[heap[0]];
+        const DayIndexEntry *e = &day->idx.files[day->first];
+        if (!(e->tstart < limit)) break;
+        day->first++;
+        int n_file = deliver_file(s, cat, day, e);
+        if (n_file < 0) {
+            free(heap);
+            return -1;
+        }
+        added += n_file;
+        if (day->first == day->end) heap[0] = heap[--n];
+        heap_sift_down(heap, n, 0, days);
+    }
+    free(heap);
+
+    // Release the days that are done
+    int kept = 0;
+    for (int k = 0; k < s->n_days; k++) {
+        if (days[k].first < days[k].end) {
+            if (kept != k) days[kept] = days[k];
+            kept++;
+        } else if (days[k].listed) {
+            day_index_close(&days[k].idx);
+        }
+    }
+    s->n_days = kept;
+    return added;
+}
+
+int scan_stream_open(ScanStream *s, const char *teldir, const char *sname, double tstart, double tend, int use_index,
+                     int n_threads) {
+    memset(s, 0, sizeof(*s));
+    s->teldir = strdup(teldir);
+    s->sname = strdup(sname);
+    if (!s->teldir || !s->sname) {
+        fprintf(stderr, "Error: out of memory for the scan\n");
+        scan_stream_close(s);
+        return 1;
+    }
+    s->tstart = tstart;
+    s->tend = tend;
+    s->use_index = use_index;
+    s->n_threads = n_threads > 0 ? n_threads : 1;
+    catalog_init(&s->held);
+
+    // We iterate from the day before tstart to the day of tend
+    time_t t_iter_raw = (time_t)tstart;
+    struct tm tm_iter;
+    gmtime_r(&t_iter_raw, &tm_iter);
+    tm_iter.tm_hour = 0;
+    tm_iter.tm_min = 0;
+    tm_iter.tm_sec = 0;
+    s->next_day = (int64_t)timegm(&tm_iter) - 24 * 3600;
+    s->last_day = (int64_t)(time_t)tend;
+    return 0;
+}
+
+int scan_stream_next(ScanStream *s, FileCatalog *cat) {
+    int first = cat->count;
+    int added = 0;
+    while (added == 0 && !s->done) {
+        if (s->next_day <= s->last_day) {
+            // List the next n_threads days
+            int n_new = (int)((s->last_day - s->next_day) / (24 * 3600)) + 1;
+            if (n_new > s->n_threads) n_new = s->n_threads;
+            ScanDay *days = (ScanDay *)realloc(s->days, (s->n_days + n_new) * sizeof(ScanDay));
+            if (!days) {
+                fprintf(stderr, "Error: out of memory for the scan\n");
+                return -1;
+            }
+            s->days = days;
+            ScanDay *fresh = days + s->n_days;
+            memset(fresh, 0, n_new * sizeof(ScanDay));
+            for (int k = 0; k < n_new; k++) {
+                fresh[k].day = (time_t)(s->next_day + (int64_t)k * 24 * 3600);
+                struct tm tm_scan;
+                gmtime_r(&fresh[k].day, &tm_scan);
+                snprintf(fresh[k].dirpath, sizeof(fresh[k].dirpath), "%s/%04d%02d%02d/%s", s->teldir,
+                         tm_scan.tm_year + 1900, tm_scan.tm_mon + 1, tm_scan.tm_mday, s->sname);
+            }
+            scan_days(s, fresh, n_new);
+            s->n_days += n_new;
+            s->next_day += (int64_t)n_new * 24 * 3600;
+        }
+
+        // Days not listed yet only hold files starting at or after their
+        // day, so the files before it are final
+        int all_listed = s->next_day > s->last_day;
+        int n = deliver_until(s, cat, all_listed ? HUGE_VAL : (double)s->next_day);
+        if (n < 0) return -1;
+        added += n;
+        if (all_listed && s->n_days == 0) {
+            // All files start at or before tstart: the last two are kept
+            n = release_held(s, cat);
+            if (n < 0) return -1;
+            added += n;
+            s->done = 1;
+        }
+    }
+    if (s->files) {
+        for (int i = first; i < first + added; i++) {
+            if (copy_file(s->files, cat, i) != 0) return -1;
+        }
+    }
+    return added;
+}
+
+void scan_stream_close(ScanStream *s) {
+    for (int k = 0; k < s->n_days; k++) {
+        if (s->days[k].listed) day_index_close(&s->days[k].idx);
+    }
+    free(s->days);
+    free(s->teldir);
+    free(s->sname);
+    catalog_free(&s->held);
+    memset(s, 0, sizeof(*s));
+}
+
+int scan_files(const char *teldir, const char *sname, double tstart, double tend, int use_index, int n_threads,
+               FileCatalog *cat) {
+    // Files already in the catalog are not part of the scan
+    int n_before = cat->count;
+    ScanStream s;
+    if (scan_stream_open(&s, teldir, sname, tstart, tend, use_index, n_threads) != 0) return 1;
+    int n;
+    while ((n = scan_stream_next(&s, cat)) > 0) {
+    }
+    scan_stream_close(&s);
+    if (n < 0) return 1;
+    if (n_before > 0) catalog_sort(cat);
+    return 0;
+}
+
+void catalog_print(const FileCatalog *cat, FILE *f) {
+    char path[MAX_PATH];
+    for (int i = 0; i < cat->count; i++) {
+        catalog_path(cat, i, path, sizeof(path));
+        fprintf(f, "%s\n", path);
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef MILK_RESAMPLE_CATALOG_H
+#define MILK_RESAMPLE_CATALOG_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "milkresample_export.h"
+
+// Catalog of the timing files of a stream, ordered by start time.
+// Strings live in one growable arena and are referenced by offset: each day
+// directory is stored once and file entries only hold their name, so the
+// memory used is proportional to the number of files and the catalog has
+// no size limit.
+
+// One timing file (40 bytes)
+typedef struct {
+    double tstart;          // Unix timestamp from the file name
+    uint32_t dir;           // Index into the catalog's directory table
+    uint32_t name;          // Arena offset of the file name
+    // Summary from the day index, if n_frames >= 0
+    int64_t first_ns;       // End of the first frame (Unix ns)
+    int64_t last_ns;        // End of the last frame (Unix ns)
+    int32_t n_frames;       // -1 if unknown
+} FileEntry;
+
+typedef struct {
+    char *arena;            // NUL-terminated strings
+    size_t arena_len;
+    size_t arena_cap;
+    uint32_t *dirs;         // Arena offset of each directory path
+    int n_dirs;
+    int cap_dirs;
+    FileEntry *files;
+    int count;
+    int cap_files;
+} FileCatalog;
+
+MILKRESAMPLE_API void catalog_init(FileCatalog *cat);
+MILKRESAMPLE_API void catalog_free(FileCatalog *cat);
+
+// Add a directory; files added afterwards with its index live in it.
+// Returns -1 if out of memory (an error has been printed).
+MILKRESAMPLE_API int catalog_add_dir(FileCatalog *cat, const char *path);
+// Add a file with an unknown summary. The entry is valid until the next
+// addition. Returns NULL if out of memory (an error has been printed).
+MILKRESAMPLE_API FileEntry *catalog_add_file(FileCatalog *cat, int dir, const char *name, double tstart);
+
+// Sort the files by start time
+MILKRESAMPLE_API void catalog_sort(FileCatalog *cat);
+
+// Keep files first .. first + n - 1 only
+MILKRESAMPLE_API void catalog_keep(FileCatalog *cat, int first, int n);
+
+// File name of file i (no directory). Valid until the next addition.
+MILKRESAMPLE_API const char *catalog_name(const FileCatalog *cat, int i);
+
+// Full path of file i. Returns 0, or 1 if it does not fit in size.
+MILKRESAMPLE_API int catalog_path(const FileCatalog *cat, int i, char *path, size_t size);
+
+// Scan delivered in start time order a few day directories at a time, so
+// that the memory used does not depend on the length of the range
+typedef struct {
+    char *teldir;
+    char *sname;
+    double tstart;
+    double tend;
+    int use_index;
+    int n_threads;
+    int64_t next_day;       // Next day directory to list (Unix s)
+    int64_t last_day;
+    struct ScanDay *days;   // Days listed whose files are not all delivered
+    int n_days;
+    FileCatalog held;       // Files starting at or before tstart, held back
+    int past_tstart;
+    int done;
+    FILE *log;              // Day index rebuilds and the files scanned (NULL: none)
+    FileCatalog *files;     // Also gets every file delivered, with its path (NULL: none)
+} ScanStream;
+
+// Start the scan of scan_files() without listing anything yet. log and
+// files are NULL: set them afterwards to have the scan reported or the
+// files kept. Returns 0 on success.
+MILKRESAMPLE_API int scan_stream_open(ScanStream *s, const char *teldir, const char *sname, double tstart, double tend,
+                                      int use_index, int n_threads);
+
+// Append the next files of the scan to cat: n_threads day directories are
+// listed at a time, and the files that cannot be preceded by files of later
+// days are added. Returns the number of files added, 0 at the end of the
+// scan, or -1 on error (an error has been printed).
+MILKRESAMPLE_API int scan_stream_next(ScanStream *s, FileCatalog *cat);
+
+MILKRESAMPLE_API void scan_stream_close(ScanStream *s);
+
+// Find the timing files of stream sname for [tstart, tend] in the day
+// directories teldir/YYYYMMDD/sname, plus the file before tstart for
+// continuity. cat must be initialized (and is usually empty).
+// With use_index, the day directories are looked up through their day
+// indexes (see dayindex.h), which also provide the file summaries; otherwise
+// they are listed. Day directories are listed by n_threads threads, and
+// their files merged in start time order. Built on the stream above.
+// Returns 0 on success.
+MILKRESAMPLE_API int scan_files(const char *teldir, const char *sname, double tstart, double tend, int use_index,
+                                int n_threads, FileCatalog *cat);
+
+// Write the full path of each file, one per line
+MILKRESAMPLE_API void catalog_print(const FileCatalog *cat, FILE *f);
+
+#endif
@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "dayindex.h"
+#include "milkresample_internal.h"
+#include "telemetry.h"
+#include "timing.h"
+
+static int index_valid(const void *base, size_t len) {
+    const DayIndexHeader *hdr = (const DayIndexHeader *)base;
+    if (len < sizeof(DayIndexHeader)) return 0;
+    if (memcmp(hdr->magic, DAY_INDEX_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version != DAY_INDEX_VERSION
+        || hdr->byte_order != DAY_INDEX_BYTE_ORDER || hdr->header_bytes != sizeof(DayIndexHeader)
+        || hdr->entry_bytes != sizeof(DayIndexEntry)) {
+        return 0;
+    }
+    if (hdr->n_files < 0 || hdr->names_bytes < 0
+        || len != sizeof(DayIndexHeader) + (size_t)hdr->n_files * sizeof(DayIndexEntry) + (size_t)hdr->names_bytes) {
+        return 0;
+    }
+    // Lookups rely on terminated names and ordered start times
+    const DayIndexEntry *files = (const DayIndexEntry *)(hdr + 1);
+    const char *names = (const char *)(files + hdr->n_files);
+    if (hdr->names_bytes > 0 && names[hdr->names_bytes - 1] != '\0') return 0;
+    for (int64_t i = 0; i < hdr->n_files; i++) {
+        if (files[i].name >= (uint64_t)hdr->names_bytes) return 0;
+        if (i > 0 && files[i].tstart < files[i - 1].tstart) return 0;
+    }
+    return 1;
+}
+
+static void index_sections(DayIndex *idx, void *base, size_t len, int owned) {
+    idx->base = base;
+    idx->len = len;
+    idx->owned = owned;
+    idx->hdr = (const DayIndexHeader *)base;
+    idx->files = (const DayIndexEntry *)(idx->hdr + 1);
+    idx->names = (const char *)(idx->files + idx->hdr->n_files);
+}
+
+// Map the index at path. Returns 0 on success, 1 if missing or unusable.
+static int index_map(DayIndex *idx, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(DayIndexHeader)) {
+        close(fd);
+        return 1;
+    }
+    size_t len = (size_t)st.st_size;
+    void *base = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return 1;
+    if (!index_valid(base, len)) {
+        munmap(base, len);
+        return 1;
+    }
+    index_sections(idx, base, len, 0);
+    return 0;
+}
+
+void day_index_close(DayIndex *idx) {
+    if (idx->base) {
+        if (idx->owned) free(idx->base);
+        else munmap(idx->base, idx->len);
+    }
+    memset(idx, 0, sizeof(*idx));
+}
+
+long day_index_count_until(const DayIndex *idx, double t) {
+    long lo = 0;
+    long hi = (long)idx->hdr->n_files;
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        if (idx->files[mid].tstart <= t) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Entry of old for name (with its start time), NULL if it has none
+static const DayIndexEntry *index_lookup(const DayIndex *old, const char *name, double tstart) {
+    if (!old->base) return NULL;
+    for (long i = day_index_count_until(old, tstart) - 1; i >= 0 && old->files[i].tstart == tstart; i--) {
+        if (strcmp(old->names + old->files[i].name, name) == 0) return &old->files[i];
+    }
+    return NULL;
+}
+
+// 64-bit FNV-1a, to name cache entries after the directory they index
+static uint64_t hash_string(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Cache directory for indexes of read-only archives, created if needed.
+// Returns 0 on success.
+static int cache_dir(char *dir, size_t size) {
+    const char *env = getenv("MILK_RESAMPLE_CACHE");
+    int n;
+    if (env && env[0]) {
+        n = snprintf(dir, size, "%s", env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) && env[0]) {
+        n = snprintf(dir, size, "%s/milk-streamtelemetry-resample", env);
+    } else if ((env = getenv("HOME")) && env[0]) {
+        char parent[MAX_PATH];
+        snprintf(parent, sizeof(parent), "%s/.cache", env);
+        mkdir(parent, 0755);
+        n = snprintf(dir, size, "%s/milk-streamtelemetry-resample", parent);
+    } else {
+        return 1;
+    }
+    if (n < 0 || (size_t)n >= size) return 1;
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) return 1;
+    return 0;
+}
+
+int day_index_paths(const char *dirpath, const char *sname, const char *suffix, char *primary, char *cached,
+                    size_t size) {
+    char day_dir[MAX_PATH];
+    snprintf(day_dir, sizeof(day_dir), "%s", dirpath);
+    char *slash = strrchr(day_dir, '/');
+    if (slash) *slash = '\0';
+    else snprintf(day_dir, sizeof(day_dir), ".");
+    int n = snprintf(primary, size, "%s/.%s.%s", day_dir, sname, suffix);
+    if (n < 0 || (size_t)n >= size) return 1;
+
+    cached[0] = '\0';
+    char dir[MAX_PATH];
+    if (cache_dir(dir, sizeof(dir)) == 0) {
+        char real[PATH_MAX];
+        const char *key = realpath(dirpath, real) ? real : dirpath;
+        slash = strrchr(day_dir, '/');
+        n = snprintf(cached, size, "%s/%s.%s.%016llx.%s", dir, slash ? slash + 1 : day_dir, sname,
+                     (unsigned long long)hash_string(key), suffix);
+        if (n < 0 || (size_t)n >= size) cached[0] = '\0';
+    }
+    return 0;
+}
+
+// Write the index atomically: readers see the old or the new file whole.
+// Returns 0 on success.
+static int index_write(const char *path, const void *base, size_t len) {
+    char tmp[MAX_PATH + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return 1;
+    int err = (fwrite(base, 1, len, f) != len);
+    if (fclose(f) != 0) err = 1;
+    if (!err && rename(tmp, path) != 0) err = 1;
+    if (err) unlink(tmp);
+    return err;
+}
+
+typedef struct {
+    DayIndexEntry *files;
+    long count;
+    long cap;
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+} IndexBuild;
+
+static int build_add(IndexBuild *b, const char *name, double tstart) {
+    size_t len = strlen(name) + 1;
+    if (b->names_len + len > UINT32_MAX) return 1;
+    if (b->names_len + len > b->names_cap) {
+        size_t cap = b->names_cap ? 2 * b->names_cap : 65536;
+        while (cap < b->names_len + len) cap *= 2;
+        char *names = (char *)realloc(b->names, cap);
+        if (!names) return 1;
+        b->names = names;
+        b->names_cap = cap;
+    }
+    if (b->count == b->cap) {
+        long cap = b->cap ? 2 * b->cap : 1024;
+        DayIndexEntry *files = (DayIndexEntry *)realloc(b->files, cap * sizeof(DayIndexEntry));
+        if (!files) return 1;
+        b->files = files;
+        b->cap = cap;
+    }
+    DayIndexEntry *e = &b->files[b->count++];
+    memset(e, 0, sizeof(*e));
+    e->tstart = tstart;
+    e->n_frames = -1;
+    e->name = (uint32_t)b->names_len;
+    memcpy(b->names + b->names_len, name, len);
+    b->names_len += len;
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const DayIndexEntry *ea = (const DayIndexEntry *)a;
+    const DayIndexEntry *eb = (const DayIndexEntry *)b;
+    if (ea->tstart < eb->tstart) return -1;
+    if (ea->tstart > eb->tstart) return 1;
+    return 0;
+}
+
+// Seconds within the day from a file name. Names written by the stream
+// loggers end in _HH:MM:SS.SSSSSSSSS.txt and are decoded at fixed offsets,
+// checking all characters at once; others go through parse_filename_time().
+// Gives the same value as parse_filename_time() for every name.
+static double filename_time(const char *filename) {
+    // Digit offsets of HH:MM:SS.SSSSSSSSS
+    static const unsigned char digit_at[15] = {0, 1, 3, 4, 6, 7, 9, 10, 11, 12, 13, 14, 15, 16, 17};
+
+    const char *p = strrchr(filename, '_');
+    if (!p || strnlen(p + 1, 19) < 19) return parse_filename_time(filename);
+    const unsigned char *c = (const unsigned char *)p + 1;
+
+    unsigned bad = (c[2] ^ ':') | (c[5] ^ ':') | (c[8] ^ '.') | (c[18] ^ '.');
+    int64_t d[15];
+    for (int i = 0; i < 15; i++) {
+        unsigned v = (unsigned)c[digit_at[i]] - '0';
+        bad |= v > 9;
+        d[i] = v;
+    }
+    if (bad) return parse_filename_time(filename);
+
+    int64_t h = d[0] * 10 + d[1];
+    int64_t m = d[2] * 10 + d[3];
+    int64_t s_ns = d[4] * 10 + d[5];
+    for (int i = 6; i < 15; i++) s_ns = s_ns * 10 + d[i];
+    // The integer is exact and the division correctly rounded, which is
+    // what sscanf() gives for the decimal seconds
+    return h * 3600.0 + m * 60.0 + (double)s_ns / 1e9;
+}
+
+static int list_entry(IndexBuild *b, const char *name, const char *sname, size_t sname_len, double day_start) {
+    if (strncmp(name, sname, sname_len) != 0 || !strstr(name, ".txt")) return 0;
+    double time_in_day = filename_time(name);
+    if (time_in_day < 0) return 0;
+    return build_add(b, name, day_start + time_in_day);
+}
+
+#ifdef __linux__
+// Record returned by getdents64
+typedef struct {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} LinuxDirent64;
+
+// Listing buffer: a day directory of 100k files takes a few system calls
+// rather than the thousands readdir() makes with its 32 kB buffer
+#define LIST_BUFFER_BYTES (4 << 20)
+#endif
+
+// List the timing files of sname in dirpath into b, ordered by start time.
+// Returns 0 on success, 1 if the directory cannot be listed, -1 if out of
+// memory (b is freed then).
+static int index_list(IndexBuild *b, const char *dirpath, const char *sname, double day_start) {
+    memset(b, 0, sizeof(*b));
+    size_t sname_len = strlen(sname);
+    int err = 0;
+#ifdef __linux__
+    int fd = open(dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return 1;
+    char *buf = (char *)malloc(LIST_BUFFER_BYTES);
+    if (!buf) err = -1;
+    while (!err) {
+        long n = syscall(SYS_getdents64, fd, buf, LIST_BUFFER_BYTES);
+        if (n <= 0) {
+            if (n < 0) err = 1;
+            break;
+        }
+        for (long off = 0; !err && off < n;) {
+            const LinuxDirent64 *ent = (const LinuxDirent64 *)(buf + off);
+            if (list_entry(b, ent->d_name, sname, sname_len, day_start) != 0) err = -1;
+            off += ent->d_reclen;
+        }
+    }
+    free(buf);
+    close(fd);
+#else
+    DIR *d = opendir(dirpath);
+    if (!d) return 1;
+    struct dirent *dir;
+    while (!err && (dir = readdir(d)) != NULL) {
+        if (list_entry(b, dir->d_name, sname, sname_len, day_start) != 0) err = -1;
+    }
+    closedir(d);
+#endif
+    if (err) {
+        if (err < 0) fprintf(stderr, "Error: out of memory listing %s\n", dirpath);
+        free(b->files);
+        free(b->names);
+        memset(b, 0, sizeof(*b));
+        return err;
+    }
+    qsort(b->files, b->count, sizeof(DayIndexEntry), compare_entries);
+    return 0;
+}
+
+// Move the listing b into an index owned by idx. dir_st is the directory
+// status taken before listing, NULL for an index that is not kept.
+static int index_pack(DayIndex *idx, IndexBuild *b, const char *dirpath, const struct stat *dir_st) {
+    size_t len = sizeof(DayIndexHeader) + (size_t)b->count * sizeof(DayIndexEntry) + b->names_len;
+    char *base = (char *)malloc(len);
+    if (!base) {
+        fprintf(stderr, "Error: out of memory for the index of %s\n", dirpath);
+        free(b->files);
+        free(b->names);
+        return 1;
+    }
+
+    DayIndexHeader *hdr = (DayIndexHeader *)base;
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, DAY_INDEX_MAGIC, sizeof(hdr->magic));
+    hdr->version = DAY_INDEX_VERSION;
+    hdr->byte_order = DAY_INDEX_BYTE_ORDER;
+    hdr->header_bytes = sizeof(DayIndexHeader);
+    hdr->entry_bytes = sizeof(DayIndexEntry);
+    hdr->n_files = b->count;
+    hdr->names_bytes = (int64_t)b->names_len;
+    // The mtime was taken before listing, so any later change invalidates
+    // the index; unless it is too recent to tell apart from such a change
+    if (dir_st && time(NULL) - dir_st->st_mtim.tv_sec >= DAY_INDEX_SETTLE) {
+        hdr->dir_mtime_sec = dir_st->st_mtim.tv_sec;
+        hdr->dir_mtime_nsec = dir_st->st_mtim.tv_nsec;
+    }
+    if (b->count > 0) memcpy(hdr + 1, b->files, b->count * sizeof(DayIndexEntry));
+    if (b->names_len > 0) {
+        memcpy(base + sizeof(DayIndexHeader) + b->count * sizeof(DayIndexEntry), b->names, b->names_len);
+    }
+    free(b->files);
+    free(b->names);
+
+    index_sections(idx, base, len, 1);
+    return 0;
+}
+
+// List dirpath and build its index in memory, reusing the summaries of old
+// (if mapped). Returns 0 on success.
+static int index_build(DayIndex *idx, const DayIndex *old, const char *dirpath, const char *sname, double day_start,
+                       const struct stat *dir_st, FILE *log) {
+    IndexBuild b;
+    if (index_list(&b, dirpath, sname, day_start) != 0) return 1;
+
+    // Read the first and last rows of new files. The newest file may still
+    // be written to: it is left unknown, and read again on the next update.
+    long n_read = 0;
+    for (long i = 0; i + 1 < b.count; i++) {
+        DayIndexEntry *e = &b.files[i];
+        const DayIndexEntry *prev = index_lookup(old, b.names + e->name, e->tstart);
+        if (prev && prev->n_frames >= 0) {
+            e->first_ns = prev->first_ns;
+            e->last_ns = prev->last_ns;
+            e->n_frames = prev->n_frames;
+            continue;
+        }
+        char path[MAX_PATH];
+        snprintf(path, sizeof(path), "%s/%s", dirpath, b.names + e->name);
+        if (timing_file_summary(path, &e->n_frames, &e->first_ns, &e->last_ns) != 0) e->n_frames = -1;
+        n_read++;
+    }
+
+    long count = b.count;
+    if (index_pack(idx, &b, dirpath, dir_st) != 0) return 1;
+    if (log) fprintf(log, "Indexed %s: %ld files, %ld read\n", dirpath, count, n_read);
+    return 0;
+}
+
+int day_index_list(DayIndex *idx, const char *dirpath, const char *sname, double day_start) {
+    memset(idx, 0, sizeof(*idx));
+    IndexBuild b;
+    if (index_list(&b, dirpath, sname, day_start) != 0) return 1;
+    return index_pack(idx, &b, dirpath, NULL);
+}
+
+int day_index_open(DayIndex *idx, const char *dirpath, const char *sname, double day_start, FILE *log) {
+    memset(idx, 0, sizeof(*idx));
+
+    struct stat st;
+    if (stat(dirpath, &st) != 0 || !S_ISDIR(st.st_mode)) return 1;
+
+    char primary[MAX_PATH], cached[MAX_PATH];
+    if (day_index_paths(dirpath, sname, "catalog", primary, cached, sizeof(primary)) != 0) {
+        primary[0] = '\0';
+        cached[0] = '\0';
+    }
+
+    // Up to date if the directory has not changed since it was listed
+    DayIndex old;
+    memset(&old, 0, sizeof(old));
+    const char *found = NULL;
+    if (primary[0] && index_map(&old, primary) == 0) found = primary;
+    else if (cached[0] && index_map(&old, cached) == 0) found = cached;
+    if (found && old.hdr->dir_mtime_sec != 0 && old.hdr->dir_mtime_sec == (int64_t)st.st_mtim.tv_sec
+        && old.hdr->dir_mtime_nsec == (int64_t)st.st_mtim.tv_nsec) {
+        *idx = old;
+        return 0;
+    }
+
+    int ret = index_build(idx, &old, dirpath, sname, day_start, &st, log);
+    day_index_close(&old);
+    if (ret != 0) return 1;
+
+    // Where it was found first, so that the stale copy is replaced
+    if ((found != cached && primary[0] && index_write(primary, idx->base, idx->len) == 0)
+        || (cached[0] && index_write(cached, idx->base, idx->len) == 0)) {
+        return 0;
+    }
+    fprintf(stderr, "Warning: could not save the index of %s\n", dirpath);
+    return 0;
+}
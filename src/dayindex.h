@@ -0,0 +1,84 @@
+#ifndef MILK_RESAMPLE_DAYINDEX_H
+#define MILK_RESAMPLE_DAYINDEX_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "milkresample_export.h"
+
+// Persistent index of the timing files of one stream and day, so that scans
+// need not list the day directory teldir/YYYYMMDD/sname and parse every
+// file name again.
+//
+// Layout (native byte order, checked through byte_order):
+//   DayIndexHeader
+//   DayIndexEntry[n_files]   ordered by start time
+//   names                    NUL-terminated file names, referenced by offset
+//
+// The index is kept as teldir/YYYYMMDD/.<sname>.catalog, or in the cache
+// directory if the archive is not writable (see day_index_open). It records
+// the modification time of the stream directory and is brought up to date
+// when that changes: the directory is listed again, but only the files that
+// are new since the last update are read.
+
+#define DAY_INDEX_MAGIC "MILKTCAT"
+#define DAY_INDEX_VERSION 1
+#define DAY_INDEX_BYTE_ORDER 0x01020304u
+
+// Directory listings younger than this may miss files created within the
+// same mtime tick on file systems with coarse timestamps [s]
+#define DAY_INDEX_SETTLE 2
+
+typedef struct {
+    char magic[8];          // DAY_INDEX_MAGIC, not NUL terminated
+    uint32_t version;       // DAY_INDEX_VERSION
+    uint32_t byte_order;    // DAY_INDEX_BYTE_ORDER as written by the producer
+    uint32_t header_bytes;  // sizeof(DayIndexHeader)
+    uint32_t entry_bytes;   // sizeof(DayIndexEntry)
+    int64_t n_files;
+    int64_t names_bytes;
+    int64_t dir_mtime_sec;  // Directory modification time when it was listed,
+    int64_t dir_mtime_nsec; // 0 if too recent to be trusted
+} DayIndexHeader;
+
+typedef struct {
+    double tstart;          // Unix timestamp from the file name
+    int64_t first_ns;       // End of the first frame (Unix ns)
+    int64_t last_ns;        // End of the last frame (Unix ns)
+    int32_t n_frames;       // -1 if unknown: unreadable, or the newest file, which may still grow
+    uint32_t name;          // Offset of the file name in the names section
+} DayIndexEntry;
+
+// Mapped or in-memory index
+typedef struct {
+    void *base;
+    size_t len;
+    int owned;              // base is a heap buffer rather than a file mapping
+    const DayIndexHeader *hdr;
+    const DayIndexEntry *files;
+    const char *names;
+} DayIndex;
+
+// Index of the timing files of stream sname in dirpath, the directory
+// teldir/YYYYMMDD/sname of the day starting at day_start. It is rebuilt
+// first if missing or out of date, and written next to the day directory or
+// else to $MILK_RESAMPLE_CACHE, $XDG_CACHE_HOME/milk-streamtelemetry-resample
+// or ~/.cache/milk-streamtelemetry-resample. If it cannot be written
+// anywhere, it is only kept in memory. Rebuilds are reported to log (NULL:
+// not reported).
+// Returns 0 on success, 1 if the directory cannot be listed.
+MILKRESAMPLE_API int day_index_open(DayIndex *idx, const char *dirpath, const char *sname, double day_start,
+                                    FILE *log);
+
+// Index of dirpath as listed now, kept in memory only and without the
+// summaries of the files (n_frames is -1 throughout): no timing file is
+// read and nothing is written. Returns 0 on success, 1 if the directory
+// cannot be listed.
+MILKRESAMPLE_API int day_index_list(DayIndex *idx, const char *dirpath, const char *sname, double day_start);
+
+MILKRESAMPLE_API void day_index_close(DayIndex *idx);
+
+// Number of files starting at or before t
+MILKRESAMPLE_API long day_index_count_until(const DayIndex *idx, double t);
+
+#endif
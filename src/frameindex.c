@@ -0,0 +1,493 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "frameindex.h"
+#include "dayindex.h"
+#include "milkresample_internal.h"
+#include "timing.h"
+
+// Longest varint of a 64-bit value
+#define VARINT_MAX 10
+
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t u) {
+    return (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t u) {
+    while (u >= 0x80) {
+        *p++ = (uint8_t)(u | 0x80);
+        u >>= 7;
+    }
+    *p++ = (uint8_t)u;
+    return p;
+}
+
+// Returns the position after the varint, NULL if it runs past end
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *u) {
+    uint64_t v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *u = v;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Encode frames 1 .. n - 1 of a block into buf (room for 2 * n varints).
+// Times are differenced in unsigned arithmetic, which wraps around
+// consistently in the decoder, so any int64 values round-trip exactly.
+static size_t encode_block(const int32_t *l_idx, const int64_t *t_ns, long n, uint8_t *buf,
+                           FrameIndexCheckpoint *cp) {
+    uint8_t *p = buf;
+    uint64_t period = 0;
+    for (long k = 1; k < n; k++) {
+        uint64_t d = (uint64_t)t_ns[k] - (uint64_t)t_ns[k - 1];
+        p = put_varint(p, zigzag((int64_t)(d - period)));
+        period = d;
+    }
+    cp->t_bytes = (uint32_t)(p - buf);
+
+    int consecutive = 1;
+    for (long k = 1; k < n && consecutive; k++) {
+        if (l_idx[k] != l_idx[k - 1] + 1) consecutive = 0;
+    }
+    if (!consecutive) {
+        for (long k = 1; k < n; k++) {
+            p = put_varint(p, zigzag((int64_t)l_idx[k] - l_idx[k - 1] - 1));
+        }
+    }
+    cp->l_idx_bytes = (uint32_t)(p - buf) - cp->t_bytes;
+    return (size_t)(p - buf);
+}
+
+static int index_valid(const void *base, size_t len) {
+    const FrameIndexHeader *hdr = (const FrameIndexHeader *)base;
+    if (len < sizeof(FrameIndexHeader)) return 0;
+    if (memcmp(hdr->magic, FRAME_INDEX_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version != FRAME_INDEX_VERSION
+        || hdr->byte_order != FRAME_INDEX_BYTE_ORDER || hdr->header_bytes != sizeof(FrameIndexHeader)
+        || hdr->file_bytes != sizeof(FrameIndexFile) || hdr->checkpoint_bytes != sizeof(FrameIndexCheckpoint)) {
+        return 0;
+    }
+    // Each section no larger than the file, so that the sum cannot overflow
+    size_t rest = len - sizeof(FrameIndexHeader);
+    if (hdr->data_bytes < 0 || (uint64_t)hdr->data_bytes > rest || hdr->data_bytes % 8 != 0
+        || hdr->n_files < 0 || (uint64_t)hdr->n_files > rest / sizeof(FrameIndexFile)
+        || hdr->n_checkpoints < 0 || (uint64_t)hdr->n_checkpoints > rest / sizeof(FrameIndexCheckpoint)
+        || hdr->names_bytes < 0 || (uint64_t)hdr->names_bytes > rest) {
+        return 0;
+    }
+    if (rest != (size_t)hdr->data_bytes + (size_t)hdr->n_files * sizeof(FrameIndexFile)
+                    + (size_t)hdr->n_checkpoints * sizeof(FrameIndexCheckpoint) + (size_t)hdr->names_bytes) {
+        return 0;
+    }
+
+    // Decoding relies on every block and name lying within its section
+    const char *data = (const char *)(hdr + 1);
+    const FrameIndexFile *files = (const FrameIndexFile *)(data + hdr->data_bytes);
+    const FrameIndexCheckpoint *cps = (const FrameIndexCheckpoint *)(files + hdr->n_files);
+    const char *names = (const char *)(cps + hdr->n_checkpoints);
+    if (hdr->names_bytes > 0 && names[hdr->names_bytes - 1] != '\0') return 0;
+    for (int64_t i = 0; i < hdr->n_files; i++) {
+        if (files[i].name >= (uint64_t)hdr->names_bytes || files[i].first_checkpoint > (uint64_t)hdr->n_checkpoints) {
+            return 0;
+        }
+    }
+    for (int64_t k = 0; k < hdr->n_checkpoints; k++) {
+        const FrameIndexCheckpoint *cp = &cps[k];
+        if (cp->file >= (uint64_t)hdr->n_files || cp->n_frames == 0 || cp->n_frames > FRAME_INDEX_BLOCK
+            || cp->offset < 0 || (uint64_t)cp->offset + cp->t_bytes + cp->l_idx_bytes > (uint64_t)hdr->data_bytes) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Map the index at path. Returns 0 on success, 1 if missing or unusable.
+static int index_map(FrameIndex *fi, const char *path) {
+    memset(fi, 0, sizeof(*fi));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FrameIndexHeader)) {
+        close(fd);
+        return 1;
+    }
+    size_t len = (size_t)st.st_size;
+    void *base = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return 1;
+    if (!index_valid(base, len)) {
+        munmap(base, len);
+        return 1;
+    }
+
+    fi->base = base;
+    fi->len = len;
+    fi->hdr = (const FrameIndexHeader *)base;
+    fi->data = (const uint8_t *)(fi->hdr + 1);
+    fi->files = (const FrameIndexFile *)(fi->data + fi->hdr->data_bytes);
+    fi->checkpoints = (const FrameIndexCheckpoint *)(fi->files + fi->hdr->n_files);
+    fi->names = (const char *)(fi->checkpoints + fi->hdr->n_checkpoints);
+    return 0;
+}
+
+int frame_index_open(FrameIndex *fi, const char *dirpath, const char *sname) {
+    char primary[MAX_PATH], cached[MAX_PATH];
+    memset(fi, 0, sizeof(*fi));
+    if (day_index_paths(dirpath, sname, "frames", primary, cached, sizeof(primary)) != 0) return 1;
+    if (index_map(fi, primary) == 0) return 0;
+    if (cached[0] && index_map(fi, cached) == 0) return 0;
+    return 1;
+}
+
+void frame_index_close(FrameIndex *fi) {
+    if (fi->base) munmap(fi->base, fi->len);
+    memset(fi, 0, sizeof(*fi));
+}
+
+// Encode the frames of the timing files listed by di into f, after the
+// header placeholder. Fills in the header summary. Returns 0 on success.
+static int write_frames(FILE *f, const DayIndex *di, const char *dirpath, FrameIndexHeader *hdr) {
+    long n_files = (long)di->hdr->n_files;
+    FrameIndexFile *files = (FrameIndexFile *)calloc(n_files > 0 ? n_files : 1, sizeof(FrameIndexFile));
+    FrameIndexCheckpoint *cps = NULL;
+    long n_cps = 0;
+    long cap_cps = 0;
+    uint8_t *buf = (uint8_t *)malloc(2 * FRAME_INDEX_BLOCK * VARINT_MAX);
+    if (!files || !buf) {
+        free(files);
+        free(buf);
+        return 1;
+    }
+
+    int err = 0;
+    int64_t prev_t = 0;
+    for (long i = 0; i < n_files && !err; i++) {
+        files[i].name = di->files[i].name;
+        files[i].first_checkpoint = (uint32_t)n_cps;
+
+        char path[MAX_PATH];
+        snprintf(path, sizeof(path), "%s/%s", dirpath, di->names + di->files[i].name);
+        TimingRows rows;
+        int load_status = timing_load_rows(path, INT64_MIN, INT64_MAX, &rows);
+        if (load_status < 0) {
+            err = 1;
+            break;
+        }
+        if (load_status != 0) {
+            fprintf(stderr, "Warning: Could not open input file %s\n", path);
+            continue;
+        }
+        files[i].n_frames = rows.n_rows;
+
+        for (long r0 = 0; r0 < rows.n_rows && !err; r0 += FRAME_INDEX_BLOCK) {
+            if (n_cps == cap_cps) {
+                cap_cps = cap_cps ? 2 * cap_cps : 1024;
+                FrameIndexCheckpoint *grown =
+                    (FrameIndexCheckpoint *)realloc(cps, cap_cps * sizeof(FrameIndexCheckpoint));
+                if (!grown) {
+                    err = 1;
+                    break;
+                }
+                cps = grown;
+            }
+            long n = rows.n_rows - r0 < FRAME_INDEX_BLOCK ? rows.n_rows - r0 : FRAME_INDEX_BLOCK;
+            FrameIndexCheckpoint *cp = &cps[n_cps++];
+            memset(cp, 0, sizeof(*cp));
+            cp->t_ns = rows.t_ns[r0];
+            cp->offset = hdr->data_bytes;
+            cp->file = (uint32_t)i;
+            cp->l_idx = rows.l_idx[r0];
+            cp->n_frames = (uint32_t)n;
+            size_t len = encode_block(rows.l_idx + r0, rows.t_ns + r0, n, buf, cp);
+            if (fwrite(buf, 1, len, f) != len) err = 1;
+            hdr->data_bytes += (int64_t)len;
+        }
+
+        for (long r = 0; r < rows.n_rows; r++) {
+            if (hdr->n_frames + r == 0) hdr->first_ns = rows.t_ns[r];
+            else if (rows.t_ns[r] < prev_t) hdr->flags &= ~FRAME_INDEX_MONOTONIC;
+            prev_t = rows.t_ns[r];
+        }
+        hdr->n_frames += rows.n_rows;
+        hdr->last_ns = prev_t;
+        timing_rows_free(&rows);
+    }
+
+    // Tables are 8-byte aligned for use in place
+    static const uint8_t pad[8];
+    size_t n_pad = (size_t)(-hdr->data_bytes & 7);
+    if (!err && fwrite(pad, 1, n_pad, f) != n_pad) err = 1;
+    hdr->data_bytes += (int64_t)n_pad;
+
+    hdr->n_files = n_files;
+    hdr->n_checkpoints = n_cps;
+    hdr->names_bytes = di->hdr->names_bytes;
+    if (!err && n_files > 0 && fwrite(files, sizeof(FrameIndexFile), n_files, f) != (size_t)n_files) err = 1;
+    if (!err && n_cps > 0 && fwrite(cps, sizeof(FrameIndexCheckpoint), n_cps, f) != (size_t)n_cps) err = 1;
+    if (!err && hdr->names_bytes > 0 && fwrite(di->names, 1, (size_t)hdr->names_bytes, f) != (size_t)hdr->names_bytes) {
+        err = 1;
+    }
+
+    free(files);
+    free(cps);
+    free(buf);
+    return err;
+}
+
+int frame_index_build(const char *dirpath, const char *sname, double day_start, int *rebuilt, FILE *log) {
+    *rebuilt = 0;
+
+    // Taken before listing, as for the day index
+    struct stat st;
+    if (stat(dirpath, &st) != 0 || !S_ISDIR(st.st_mode)) return 1;
+
+    DayIndex di;
+    if (day_index_open(&di, dirpath, sname, day_start, log) != 0) return 1;
+
+    // The newest file may still grow without changing the directory
+    int64_t newest_size = 0;
+    char path[MAX_PATH];
+    if (di.hdr->n_files > 0) {
+        struct stat fst;
+        snprintf(path, sizeof(path), "%s/%s", dirpath, di.names + di.files[di.hdr->n_files - 1].name);
+        if (stat(path, &fst) == 0) newest_size = (int64_t)fst.st_size;
+    }
+
+    char primary[MAX_PATH], cached[MAX_PATH];
+    if (day_index_paths(dirpath, sname, "frames", primary, cached, sizeof(primary)) != 0) {
+        fprintf(stderr, "Error: path too long for the frame index of %s\n", dirpath);
+        day_index_close(&di);
+        return -1;
+    }
+
+    FrameIndex old;
+    const char *found = NULL;
+    if (index_map(&old, primary) == 0) found = primary;
+    else if (cached[0] && index_map(&old, cached) == 0) found = cached;
+    if (found) {
+        int current = old.hdr->dir_mtime_sec != 0 && old.hdr->dir_mtime_sec == (int64_t)st.st_mtim.tv_sec
+                      && old.hdr->dir_mtime_nsec == (int64_t)st.st_mtim.tv_nsec && old.hdr->newest_size == newest_size;
+        frame_index_close(&old);
+        if (current) {
+            day_index_close(&di);
+            return 0;
+        }
+    }
+
+    // Where it was found first, so that the stale copy is replaced
+    const char *dest[2] = {found == cached ? NULL : primary, cached[0] ? cached : NULL};
+    char tmp[MAX_PATH + 32];
+    FILE *f = NULL;
+    const char *out = NULL;
+    for (int c = 0; c < 2 && !f; c++) {
+        if (!dest[c]) continue;
+        snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", dest[c], (long)getpid());
+        f = fopen(tmp, "wb");
+        out = dest[c];
+    }
+    if (!f) {
+        fprintf(stderr, "Error: could not write the frame index of %s\n", dirpath);
+        day_index_close(&di);
+        return -1;
+    }
+
+    FrameIndexHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FRAME_INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = FRAME_INDEX_VERSION;
+    hdr.byte_order = FRAME_INDEX_BYTE_ORDER;
+    hdr.header_bytes = sizeof(FrameIndexHeader);
+    hdr.file_bytes = sizeof(FrameIndexFile);
+    hdr.checkpoint_bytes = sizeof(FrameIndexCheckpoint);
+    hdr.flags = FRAME_INDEX_MONOTONIC;
+    hdr.newest_size = newest_size;
+    if (time(NULL) - st.st_mtim.tv_sec >= DAY_INDEX_SETTLE) {
+        hdr.dir_mtime_sec = st.st_mtim.tv_sec;
+        hdr.dir_mtime_nsec = st.st_mtim.tv_nsec;
+    }
+
+    // Header placeholder, completed once the sections are written
+    int err = (fwrite(&hdr, sizeof(hdr), 1, f) != 1);
+    if (!err) err = write_frames(f, &di, dirpath, &hdr);
+    if (!err && (fseek(f, 0, SEEK_SET) != 0 || fwrite(&hdr, sizeof(hdr), 1, f) != 1)) err = 1;
+    if (fclose(f) != 0) err = 1;
+    if (!err && rename(tmp, out) != 0) err = 1;
+    day_index_close(&di);
+    if (err) {
+        unlink(tmp);
+        fprintf(stderr, "Error: could not write the frame index of %s\n", dirpath);
+        return -1;
+    }
+
+    if (log) {
+        long long size = (long long)(sizeof(hdr) + hdr.data_bytes + hdr.n_files * sizeof(FrameIndexFile)
+                                     + hdr.n_checkpoints * sizeof(FrameIndexCheckpoint) + hdr.names_bytes);
+        fprintf(log, "Frame index %s: %lld files, %lld frames, %.2f bytes per frame\n", dirpath,
+                (long long)hdr.n_files, (long long)hdr.n_frames, hdr.n_frames > 0 ? (double)size / hdr.n_frames : 0.0);
+    }
+    *rebuilt = 1;
+    return 0;
+}
+
+// Start of the UTC day holding t_ns (Unix s)
+static int64_t day_of(int64_t t_ns) {
+    int64_t s = t_ns / 1000000000LL;
+    if (t_ns % 1000000000LL < 0) s--;
+    int64_t r = s % 86400;
+    if (r < 0) r += 86400;
+    return s - r;
+}
+
+void frame_index_iter_init(FrameIndexIter *it, const char *teldir, const char *sname, int64_t t0_ns,
+                           int64_t t1_ns) {
+    memset(it, 0, sizeof(*it));
+    snprintf(it->teldir, sizeof(it->teldir), "%s", teldir);
+    snprintf(it->sname, sizeof(it->sname), "%s", sname);
+    it->t0_ns = t0_ns;
+    it->t1_ns = t1_ns;
+    // The last file of the day before may run past midnight, and the frame
+    // live at t1 may be the first of the next day
+    it->day = day_of(t0_ns) - 86400;
+    it->last_day = day_of(t1_ns) + 86400;
+}
+
+void frame_index_iter_free(FrameIndexIter *it) {
+    frame_index_close(&it->cur);
+}
+
+static void iter_load_block(FrameIndexIter *it, int64_t k) {
+    const FrameIndexCheckpoint *cp = &it->cur.checkpoints[k];
+    it->block = k;
+    it->j = 0;
+    it->t_pos = it->cur.data + cp->offset;
+    it->l_idx_pos = it->t_pos + cp->t_bytes;
+    it->block_end = it->l_idx_pos + cp->l_idx_bytes;
+}
+
+// Map the index of the next day and position on the block that holds the
+// first frame ending after t0. Returns 0 if there is one.
+static int iter_open_day(FrameIndexIter *it) {
+    time_t day = (time_t)it->day;
+    it->day += 86400;
+    struct tm tm_day;
+    gmtime_r(&day, &tm_day);
+    int n = snprintf(it->dirpath, sizeof(it->dirpath), "%s/%04d%02d%02d/%s", it->teldir, tm_day.tm_year + 1900,
+                     tm_day.tm_mon + 1, tm_day.tm_mday, it->sname);
+    if (n < 0 || (size_t)n >= sizeof(it->dirpath)) return 1;
+
+    if (frame_index_open(&it->cur, it->dirpath, it->sname) != 0) {
+        struct stat st;
+        if (stat(it->dirpath, &st) == 0 && S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "Warning: %s has no frame index, its frames are skipped\n", it->dirpath);
+        }
+        return 1;
+    }
+
+    const FrameIndexHeader *hdr = it->cur.hdr;
+    int monotonic = (hdr->flags & FRAME_INDEX_MONOTONIC) != 0;
+    if (hdr->n_checkpoints == 0 || (monotonic && hdr->last_ns <= it->t0_ns)) {
+        // Ends before the range: only the end of its last frame matters
+        if (hdr->n_frames > 0) it->prev_end_ns = hdr->last_ns;
+        frame_index_close(&it->cur);
+        return 1;
+    }
+
+    // Last block starting at or before t0: the frames skipped in it give the end
+    // of the frame before the first one returned
+    int64_t k = 0;
+    if (monotonic) {
+        int64_t lo = 0;
+        int64_t hi = hdr->n_checkpoints;
+        while (lo < hi) {
+            int64_t mid = lo + (hi - lo) / 2;
+            if (it->cur.checkpoints[mid].t_ns <= it->t0_ns) lo = mid + 1;
+            else hi = mid;
+        }
+        k = lo > 0 ? lo - 1 : 0;
+    }
+    iter_load_block(it, k);
+    return 0;
+}
+
+// Decode the next frame of the current block. Returns 0 on success.
+static int iter_decode(FrameIndexIter *it) {
+    const FrameIndexCheckpoint *cp = &it->cur.checkpoints[it->block];
+    if (it->j == 0) {
+        it->t_ns = cp->t_ns;
+        it->l_idx = cp->l_idx;
+        it->period_ns = 0;
+    } else {
+        uint64_t u;
+        const uint8_t *t_end = it->cur.data + cp->offset + cp->t_bytes;
+        if (!(it->t_pos = get_varint(it->t_pos, t_end, &u))) return 1;
+        it->period_ns = (int64_t)((uint64_t)it->period_ns + (uint64_t)unzigzag(u));
+        it->t_ns = (int64_t)((uint64_t)it->t_ns + (uint64_t)it->period_ns);
+        if (cp->l_idx_bytes > 0) {
+            if (!(it->l_idx_pos = get_varint(it->l_idx_pos, it->block_end, &u))) return 1;
+            it->l_idx = (int32_t)(it->l_idx + 1 + unzigzag(u));
+        } else {
+            it->l_idx++;
+        }
+    }
+    it->j++;
+    return 0;
+}
+
+int frame_index_iter_next(FrameIndexIter *it, FrameLocation *loc) {
+    while (!it->done) {
+        if (!it->cur.base) {
+            if (it->day > it->last_day) break;
+            iter_open_day(it);
+            continue;
+        }
+
+        const FrameIndexCheckpoint *cp = &it->cur.checkpoints[it->block];
+        if (it->j == cp->n_frames) {
+            if (it->block + 1 == it->cur.hdr->n_checkpoints) {
+                frame_index_close(&it->cur);
+                continue;
+            }
+            iter_load_block(it, it->block + 1);
+            cp = &it->cur.checkpoints[it->block];
+        }
+        if (iter_decode(it) != 0) {
+            fprintf(stderr, "Warning: corrupt frame index for %s, its frames are skipped\n", it->dirpath);
+            frame_index_close(&it->cur);
+            continue;
+        }
+        if (it->t_ns <= it->t0_ns) {
+            it->prev_end_ns = it->t_ns;
+            continue;
+        }
+        if (it->prev_end_ns >= it->t1_ns) {
+            // Times increase: this frame and all later ones start at or after t1
+            if (it->cur.hdr->flags & FRAME_INDEX_MONOTONIC) break;
+            // Otherwise a later frame of the day may still be in the range
+            it->prev_end_ns = it->t_ns;
+            continue;
+        }
+
+        loc->dir = it->dirpath;
+        loc->name = it->cur.names + it->cur.files[cp->file].name;
+        loc->l_idx = it->l_idx;
+        loc->t_start_ns = it->prev_end_ns;
+        loc->t_end_ns = it->t_ns;
+        it->prev_end_ns = it->t_ns;
+        return 1;
+    }
+    it->done = 1;
+    return 0;
+}
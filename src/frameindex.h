@@ -0,0 +1,149 @@
+#ifndef MILK_RESAMPLE_FRAMEINDEX_H
+#define MILK_RESAMPLE_FRAMEINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "telemetry.h"
+#include "milkresample_export.h"
+
+// Frame-level time index of one stream and day: the col1 and col5 values of
+// every timing file of teldir/YYYYMMDD/sname, so that the frame live at a
+// given time can be found without reading any timing file.
+//
+// Layout (native byte order, checked through byte_order):
+//   FrameIndexHeader
+//   data                                 encoded blocks of frames, padded to 8 bytes
+//   FrameIndexFile[n_files]              timing files, ordered by start time
+//   FrameIndexCheckpoint[n_checkpoints]  one per block, ordered in time
+//   names                                NUL-terminated file names
+//
+// Frames are stored in blocks of up to FRAME_INDEX_BLOCK frames of one
+// file. The checkpoint of a block holds its first frame in full. The block
+// data holds the other frames column by column as zigzag varints: col5 as
+// the change of the frame period (frames come from a hardware clock, so
+// this is the jitter, usually 1-2 bytes), then col1 as the change of the
+// frame index, left out when all frames of the block are consecutive. A
+// lookup bisects the checkpoints and decodes at most one block.
+//
+// Blocks are written as the timing files are parsed, and the tables after
+// them, so building a day needs memory for the tables only.
+//
+// The index is kept as teldir/YYYYMMDD/.<sname>.frames, or in the cache
+// directory (see day_index_open), and rebuilt by frame_index_build() when
+// the stream directory or its newest file change.
+
+#define FRAME_INDEX_MAGIC "MILKFIDX"
+#define FRAME_INDEX_VERSION 1
+#define FRAME_INDEX_BYTE_ORDER 0x01020304u
+
+// Frames per block
+#define FRAME_INDEX_BLOCK 1024
+
+// Frame end times increase throughout the day, so checkpoints can be bisected
+#define FRAME_INDEX_MONOTONIC 0x1u
+
+typedef struct {
+    char magic[8];             // FRAME_INDEX_MAGIC, not NUL terminated
+    uint32_t version;          // FRAME_INDEX_VERSION
+    uint32_t byte_order;       // FRAME_INDEX_BYTE_ORDER as written by the producer
+    uint32_t header_bytes;     // sizeof(FrameIndexHeader)
+    uint32_t file_bytes;       // sizeof(FrameIndexFile)
+    uint32_t checkpoint_bytes; // sizeof(FrameIndexCheckpoint)
+    uint32_t flags;            // FRAME_INDEX_MONOTONIC
+    int64_t data_bytes;
+    int64_t n_files;
+    int64_t n_checkpoints;
+    int64_t names_bytes;
+    int64_t n_frames;
+    int64_t first_ns;          // End of the first and last frames of the day (Unix ns)
+    int64_t last_ns;
+    int64_t dir_mtime_sec;     // Stream directory modification time when built,
+    int64_t dir_mtime_nsec;    // 0 if too recent to be trusted
+    int64_t newest_size;       // Size of the newest timing file when built
+} FrameIndexHeader;
+
+typedef struct {
+    uint32_t name;             // Offset of the file name in the names section
+    uint32_t first_checkpoint; // First block of the file
+    int64_t n_frames;
+} FrameIndexFile;
+
+typedef struct {
+    int64_t t_ns;              // End time of the first frame of the block (Unix ns)
+    int64_t offset;            // Offset of the block in the data section
+    uint32_t file;             // Index into the file table
+    int32_t l_idx;             // Frame index of the first frame of the block
+    uint32_t n_frames;         // Frames in the block
+    uint32_t t_bytes;          // Size of the col5 part of the block data
+    uint32_t l_idx_bytes;      // Size of the col1 part, 0 if the frames are consecutive
+    uint32_t reserved;
+} FrameIndexCheckpoint;
+
+// Mapped frame index of one day
+typedef struct {
+    void *base;
+    size_t len;
+    const FrameIndexHeader *hdr;
+    const uint8_t *data;
+    const FrameIndexFile *files;
+    const FrameIndexCheckpoint *checkpoints;
+    const char *names;
+} FrameIndex;
+
+// Build the frame index of dirpath, the directory teldir/YYYYMMDD/sname of
+// the day starting at day_start, unless it is up to date. Sets rebuilt to
+// whether it was built. Rebuilds, also of the day index, are reported to log
+// (NULL: not reported). Returns 0 on success, 1 if the directory cannot be
+// listed, -1 if the index cannot be written (an error has been printed).
+MILKRESAMPLE_API int frame_index_build(const char *dirpath, const char *sname, double day_start, int *rebuilt,
+                                       FILE *log);
+
+// Map the frame index of dirpath. Returns 0 on success, 1 if there is none
+// or it cannot be used.
+MILKRESAMPLE_API int frame_index_open(FrameIndex *fi, const char *dirpath, const char *sname);
+
+MILKRESAMPLE_API void frame_index_close(FrameIndex *fi);
+
+// One frame found through the index. Strings are valid until the next call.
+typedef struct {
+    const char *dir;           // Directory of the timing file
+    const char *name;          // Timing file name
+    int32_t l_idx;             // Frame index within the file (col1)
+    int64_t t_start_ns;        // End of the previous frame, 0 if not known
+    int64_t t_end_ns;          // Frame end time (col5, Unix ns)
+} FrameLocation;
+
+// Iterates over the frames live during [t0_ns, t1_ns) as mkts selects
+// them: the frames ending after t0_ns and starting before t1_ns, across
+// day directories. Days whose directory exists
+// but has no frame index are skipped with a warning.
+typedef struct {
+    char teldir[MAX_PATH];
+    char sname[256];
+    int64_t t0_ns;
+    int64_t t1_ns;
+    int64_t day;               // Start of the next day to read (Unix s)
+    int64_t last_day;
+    char dirpath[MAX_PATH];    // Day directory being read
+    FrameIndex cur;            // Its index, if mapped
+    int64_t block;             // Current block, and next frame within it
+    uint32_t j;
+    const uint8_t *t_pos;      // Decoding positions in the block data
+    const uint8_t *l_idx_pos;
+    const uint8_t *block_end;
+    int64_t t_ns;              // Last frame decoded, and its period
+    int64_t period_ns;
+    int32_t l_idx;
+    int64_t prev_end_ns;       // End of the frame before the next one, 0 if not known
+    int done;
+} FrameIndexIter;
+
+MILKRESAMPLE_API void frame_index_iter_init(FrameIndexIter *it, const char *teldir, const char *sname, int64_t t0_ns,
+                                            int64_t t1_ns);
+
+// Next frame. Returns 1 if loc was filled in, 0 at the end.
+MILKRESAMPLE_API int frame_index_iter_next(FrameIndexIter *it, FrameLocation *loc);
+
+MILKRESAMPLE_API void frame_index_iter_free(FrameIndexIter *it);
+
+#endif
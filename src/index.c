@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "telemetry.h"
+#include "frameindex.h"
+
+// Frame-level time index: builds the per-day frame indexes of a stream and
+// answers time queries from them, without reading the timing files.
+
+void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] build <teldir> <sname> <tstart> <tend>\n", prog);
+    fprintf(stderr, "       %s query <teldir> <sname> <time> [tend]\n", prog);
+    fprintf(stderr, "  build  index the frames of the days from tstart to tend (and the day before)\n");
+    fprintf(stderr, "  query  frame live at <time>, or the frames live from <time> to tend, per file\n");
+    fprintf(stderr, "Times as for mkts; tend may be relative to the start time (+seconds).\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -t, --threads N build N days at a time (default: 1)\n");
+}
+
+// Unix ns as seconds with 9 decimals, and as UT
+static void print_ns(const char *label, int64_t ns) {
+    char ut[64];
+    format_time((double)ns * 1e-9, ut, sizeof(ut));
+    printf("  %s %lld.%09lld (%s)\n", label, (long long)(ns / 1000000000LL), (long long)(ns % 1000000000LL), ut);
+}
+
+typedef struct {
+    const char *teldir;
+    const char *sname;
+    const int64_t *days;
+    int n;
+    int next;               // Next day to claim
+    int n_built;
+    int n_missing;          // No directory for the day
+    int n_failed;
+} BuildJob;
+
+static void *build_worker(void *arg) {
+    BuildJob *job = (BuildJob *)arg;
+    for (;;) {
+        int k = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (k >= job->n) break;
+        time_t day = (time_t)job->days[k];
+        struct tm tm_day;
+        gmtime_r(&day, &tm_day);
+        char dirpath[MAX_PATH];
+        snprintf(dirpath, sizeof(dirpath), "%s/%04d%02d%02d/%s", job->teldir, tm_day.tm_year + 1900,
+                 tm_day.tm_mon + 1, tm_day.tm_mday, job->sname);
+        int rebuilt = 0;
+        int ret = frame_index_build(dirpath, job->sname, (double)day, &rebuilt, stdout);
+        if (ret > 0) __atomic_fetch_add(&job->n_missing, 1, __ATOMIC_RELAXED);
+        if (ret < 0) __atomic_fetch_add(&job->n_failed, 1, __ATOMIC_RELAXED);
+        if (rebuilt) __atomic_fetch_add(&job->n_built, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static int build(const char *teldir, const char *sname, double tstart, double tend, int n_threads) {
+    // Days as scanned by mkts: from the day before tstart to the day of tend
+    int64_t first_day = (int64_t)floor(tstart / 86400.0) * 86400 - 86400;
+    int64_t last_day = (int64_t)floor(tend / 86400.0) * 86400;
+    int n_days = (int)((last_day - first_day) / 86400) + 1;
+    int64_t *days = (int64_t *)malloc(n_days * sizeof(int64_t));
+    if (!days) {
+        fprintf(stderr, "Error: out of memory for %d days\n", n_days);
+        return 1;
+    }
+    for (int k = 0; k < n_days; k++) days[k] = first_day + (int64_t)k * 86400;
+
+    BuildJob job = {teldir, sname, days, n_days, 0, 0, 0, 0};
+    int n_extra = n_threads - 1;
+    if (n_extra > n_days - 1) n_extra = n_days - 1;
+    pthread_t *threads = NULL;
+    int n_started = 0;
+    if (n_extra > 0) {
+        // Without threads, the calling thread builds every day
+        threads = (pthread_t *)malloc(n_extra * sizeof(pthread_t));
+        for (; threads && n_started < n_extra; n_started++) {
+            if (pthread_create(&threads[n_started], NULL, build_worker, &job) != 0) break;
+        }
+    }
+    build_worker(&job);
+    for (int t = 0; t < n_started; t++) pthread_join(threads[t], NULL);
+    free(threads);
+    free(days);
+
+    printf("%d day(s) indexed, %d already up to date\n", job.n_built,
+           n_days - job.n_built - job.n_missing - job.n_failed);
+    return job.n_failed > 0 ? 1 : 0;
+}
+
+static int query_time(const char *teldir, const char *sname, int64_t t_ns) {
+    FrameIndexIter it;
+    FrameLocation loc;
+    // The frame live at t_ns: [t_ns, t_ns + 1 ns) holds only that instant
+    frame_index_iter_init(&it, teldir, sname, t_ns, t_ns + 1);
+    int found = frame_index_iter_next(&it, &loc);
+    if (found) {
+        printf("%s/%s frame %d\n", loc.dir, loc.name, loc.l_idx);
+        if (loc.t_start_ns != 0) print_ns("start", loc.t_start_ns);
+        print_ns("end  ", loc.t_end_ns);
+    } else {
+        printf("No frame found\n");
+    }
+    frame_index_iter_free(&it);
+    return found ? 0 : 1;
+}
+
+// Frames of the range, as runs of consecutive frames of one file
+static int query_range(const char *teldir, const char *sname, int64_t t0_ns, int64_t t1_ns) {
+    FrameIndexIter it;
+    FrameLocation loc;
+    frame_index_iter_init(&it, teldir, sname, t0_ns, t1_ns);
+
+    char run_path[MAX_PATH] = "";
+    int32_t run_first = 0, run_last = 0;
+    long n_frames = 0;
+    long n_files = 0;
+    int have_run = 0;
+    for (;;) {
+        int more = frame_index_iter_next(&it, &loc);
+        char path[MAX_PATH] = "";
+        if (more) snprintf(path, sizeof(path), "%s/%s", loc.dir, loc.name);
+        int same_file = have_run && strcmp(path, run_path) == 0;
+        if (have_run && (!same_file || loc.l_idx != run_last + 1)) {
+            printf("%s frames %d-%d (%d)\n", run_path, run_first, run_last, run_last - run_first + 1);
+        }
+        if (!more) break;
+        if (!same_file) {
+            snprintf(run_path, sizeof(run_path), "%s", path);
+            n_files++;
+        }
+        if (!same_file || loc.l_idx != run_last + 1) run_first = loc.l_idx;
+        run_last = loc.l_idx;
+        have_run = 1;
+        n_frames++;
+    }
+    printf("%ld frames in %ld file(s)\n", n_frames, n_files);
+    frame_index_iter_free(&it);
+    return n_frames > 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    int n_threads = 1;
+
+    static struct option long_options[] = {
+        {"threads", required_argument, 0, 't'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+t:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                n_threads = atoi(optarg);
+                if (n_threads < 1) {
+                    fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    int n_args = argc - optind;
+    char **args = argv + optind;
+    int is_build = n_args == 5 && strcmp(args[0], "build") == 0;
+    int is_query = (n_args == 4 || n_args == 5) && strcmp(args[0], "query") == 0;
+    if (!is_build && !is_query) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    const char *teldir = args[1];
+    const char *sname = args[2];
+    double tstart = parse_time_arg(args[3], 0);
+    if (tstart < 0) {
+        fprintf(stderr, "Error parsing time: %s\n", args[3]);
+        return 1;
+    }
+    double tend = tstart;
+    if (n_args == 5) {
+        tend = parse_time_arg(args[4], tstart);
+        if (tend < 0) {
+            fprintf(stderr, "Error parsing tend: %s\n", args[4]);
+            return 1;
+        }
+        if (tend < tstart) {
+            fprintf(stderr, "Error: tend %s is before tstart %s\n", args[4], args[3]);
+            return 1;
+        }
+    }
+
+    if (is_build) return build(teldir, sname, tstart, tend, n_threads);
+    if (n_args == 4) return query_time(teldir, sname, llround(tstart * 1e9));
+    return query_range(teldir, sname, llround(tstart * 1e9), llround(tend * 1e9));
+}
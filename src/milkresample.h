@@ -0,0 +1,26 @@
+#ifndef MILK_RESAMPLE_H
+#define MILK_RESAMPLE_H
+
+// Public interface of libmilkresample.
+//
+//   telemetry.h  scan timing files and build resample schedules
+//   catalog.h    timing files of a stream, ordered by time
+//   dayindex.h   persistent per-day index of the timing files
+//   frameindex.h per-day frame-level time index and time queries
+//   timing.h     parse timing files
+//   schedule.h   binary schedule format, mapping and frame iterator
+//   apply.h      resample FITS cubes, or stream frames through a ResampleContext
+//
+// The library keeps no global state: everything lives in caller-owned
+// structures or contexts.
+
+#include "milkresample_export.h"
+#include "schedule.h"
+#include "telemetry.h"
+#include "catalog.h"
+#include "dayindex.h"
+#include "frameindex.h"
+#include "timing.h"
+#include "apply.h"
+
+#endif
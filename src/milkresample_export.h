@@ -0,0 +1,12 @@
+#ifndef MILK_RESAMPLE_EXPORT_H
+#define MILK_RESAMPLE_EXPORT_H
+
+// The library is built with hidden visibility: only declarations marked
+// MILKRESAMPLE_API are exported from the shared object.
+#if defined(__GNUC__)
+#define MILKRESAMPLE_API __attribute__((visibility("default")))
+#else
+#define MILKRESAMPLE_API
+#endif
+
+#endif
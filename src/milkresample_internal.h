@@ -0,0 +1,17 @@
+#ifndef MILK_RESAMPLE_INTERNAL_H
+#define MILK_RESAMPLE_INTERNAL_H
+
+#include <stddef.h>
+
+// Functions shared between the translation units of libmilkresample.
+// This header is not installed and its functions are not exported.
+
+// Locations of the .<suffix> index of dirpath = teldir/YYYYMMDD/sname: next
+// to the stream directory (not inside it, which would change its mtime),
+// and in the cache directory under a name unique to the directory (cached
+// is empty if there is none). Returns 0 if they fit in size. Also used for
+// the frame index (frameindex.h).
+int day_index_paths(const char *dirpath, const char *sname, const char *suffix, char *primary, char *cached,
+                    size_t size);
+
+#endif
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "telemetry.h"
+#include "apply.h"
+
+// One-shot resampling: scans the telemetry like mkts, keeps the schedule in
+// memory and applies it directly, without a schedule file in between.
+
+void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] <teldir> <sname> <tstart> <tend> <dt> [offset]\n", prog);
+    fprintf(stderr, "Writes <sname>.resample.fits\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -x, --text      also export the schedule as text (<sname>.resample.txt)\n");
+    fprintf(stderr, "  -j, --jitter S  largest deviation of a frame from its fitted clock segment [s] (default: %g)\n",
+            DEFAULT_JITTER);
+    fprintf(stderr, "      --no-index  list the day directories instead of using their indexes\n");
+    fprintf(stderr, "      --scan-threads N list day directories and parse timing files with N threads\n");
+    fprintf(stderr, "                  (default: the --threads count)\n");
+    apply_print_options(stderr);
+    fprintf(stderr, "--threads sets both the accumulation threads and, without --scan-threads, the scan threads\n");
+}
+
+int main(int argc, char *argv[]) {
+    int write_text = 0;
+    double jitter = DEFAULT_JITTER;
+    int use_index = 1;
+    int scan_threads = 0;
+    ApplyOptions apply_opt;
+    apply_default_options(&apply_opt);
+    apply_opt.log = stdout;
+
+    static struct option long_options[] = {
+        {"text", no_argument, 0, 'x'},
+        {"jitter", required_argument, 0, 'j'},
+        {"no-index", no_argument, 0, 'I'},
+        {"scan-threads", required_argument, 0, 'S'},
+        APPLY_LONG_OPTIONS,
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    // Options must come first: a negative offset is a positional argument
+    while ((opt = getopt_long(argc, argv, "+xj:h" APPLY_SHORT_OPTIONS, long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'x':
+                write_text = 1;
+                break;
+            case 'I':
+                use_index = 0;
+                break;
+            case 'S':
+                scan_threads = atoi(optarg);
+                if (scan_threads < 1) {
+                    fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'j':
+                jitter = atof(optarg);
+                if (jitter < 0) {
+                    fprintf(stderr, "Invalid jitter tolerance: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default: {
+                int ret = apply_parse_option(&apply_opt, opt, optarg);
+                if (ret > 0) return 1;
+                if (ret < 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            }
+        }
+    }
+
+    // -t drives the scan too, unless --scan-threads is given
+    if (scan_threads == 0) scan_threads = apply_opt.n_threads;
+
+    int n_args = argc - optind;
+    if (n_args != 5 && n_args != 6) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    char **args = argv + optind;
+    const char *teldir = args[0];
+    const char *sname = args[1];
+    const char *tstart_str = args[2];
+    const char *tend_str = args[3];
+    double dt = atof(args[4]);
+    double offset = 0.0;
+    if (n_args == 6) {
+        offset = atof(args[5]);
+    }
+
+    double tstart = parse_time_arg(tstart_str, 0);
+    if (tstart < 0) {
+        fprintf(stderr, "Error parsing tstart: %s\n", tstart_str);
+        return 1;
+    }
+
+    double tend = parse_time_arg(tend_str, tstart);
+    if (tend < 0) {
+        fprintf(stderr, "Error parsing tend: %s\n", tend_str);
+        return 1;
+    }
+
+    tstart += offset;
+    tend += offset;
+
+    print_time_info(stdout, tstart, tend);
+
+    // The scan feeds the schedule build as in mkts; the files are kept, in
+    // schedule order, to resolve their FITS cubes
+    ScanStream scan;
+    if (scan_stream_open(&scan, teldir, sname, tstart, tend, use_index, scan_threads) != 0) return 1;
+    scan.log = stdout;
+    FileCatalog cat;
+    catalog_init(&cat);
+    scan.files = &cat;
+    ScheduleMap sched;
+    int built = process_telemetry_stream(&scan, dt, jitter, scan_threads, write_text, &sched);
+    scan_stream_close(&scan);
+    if (built != 0) {
+        catalog_free(&cat);
+        return 1;
+    }
+    int file_count = cat.count;
+
+    // The file table holds the scanned files in order: resolve the FITS cube
+    // of each one from its full path
+    char **fits_paths = calloc(file_count > 0 ? file_count : 1, sizeof(char *));
+    if (!fits_paths) {
+        fprintf(stderr, "Error: out of memory for the FITS paths\n");
+        schedule_map_close(&sched);
+        catalog_free(&cat);
+        return 1;
+    }
+    char path[MAX_PATH];
+    char fits_path[MAX_PATH + 8];
+    for (int i = 0; i < file_count; i++) {
+        catalog_path(&cat, i, path, sizeof(path));
+        if (fits_path_for_timing_file(path, fits_path, sizeof(fits_path)) == 0) {
+            fits_paths[i] = strdup(fits_path);
+            if (!fits_paths[i]) fprintf(stderr, "Warning: out of memory, frames of %s are skipped\n", path);
+        } else {
+            fprintf(stderr, "Warning: no FITS cube found for %s, its frames are skipped\n", path);
+        }
+    }
+
+    char out_filename[MAX_PATH];
+    snprintf(out_filename, sizeof(out_filename), "%s.resample.fits", sname);
+    int ret = apply_resample_map(&sched, (const char *const *)fits_paths, out_filename, &apply_opt);
+
+    for (int i = 0; i < file_count; i++) free(fits_paths[i]);
+    free(fits_paths);
+    schedule_map_close(&sched);
+    catalog_free(&cat);
+    return ret == 0 ? 0 : 1;
+}
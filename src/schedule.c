@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "schedule.h"
+
+// Append one entry to the file table. Returns 0 on success.
+static int writer_add_entry(ScheduleWriter *w, const char *name) {
+    ScheduleFileEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    if (strlen(name) >= SCHEDULE_NAME_LEN) {
+        fprintf(stderr, "Error: file name too long for schedule: %s\n", name);
+        return 1;
+    }
+    strcpy(entry.name, name);
+    return fwrite(&entry, sizeof(entry), 1, w->f) == 1 ? 0 : 1;
+}
+
+int schedule_writer_open(ScheduleWriter *w, const char *path, const char *const *names, long n_files,
+                         double tstart, double dt, double jitter) {
+    memset(&w->hdr, 0, sizeof(w->hdr));
+    memcpy(w->hdr.magic, SCHEDULE_MAGIC, sizeof(w->hdr.magic));
+    w->hdr.version = SCHEDULE_VERSION;
+    w->hdr.byte_order = SCHEDULE_BYTE_ORDER;
+    w->hdr.header_bytes = sizeof(ScheduleHeader);
+    w->hdr.file_bytes = sizeof(ScheduleFileEntry);
+    w->hdr.clock_bytes = sizeof(ScheduleClock);
+    w->hdr.n_files = n_files;
+    w->hdr.n_rows = -1;
+    w->hdr.tstart_ns = llround(tstart * 1e9);
+    w->hdr.dt = dt;
+    w->hdr.jitter = jitter;
+    w->jitter_ns = llround(jitter * 1e9);
+    w->cur.n_frames = 0;
+    w->mem = NULL;
+    w->mem_len = 0;
+    w->clock_f = NULL;
+
+    w->f = path ? fopen(path, "wb") : open_memstream(&w->mem, &w->mem_len);
+    if (!w->f) {
+        fprintf(stderr, "Error opening output file %s\n", path ? path : "(memory)");
+        return 1;
+    }
+    w->clock_f = names ? w->f : tmpfile();
+    if (!w->clock_f) {
+        fprintf(stderr, "Error: could not create a temporary file for the schedule\n");
+        schedule_writer_discard(w);
+        return 1;
+    }
+
+    // Header is rewritten with the final counts on close
+    fwrite(&w->hdr, sizeof(w->hdr), 1, w->f);
+    for (long i = 0; names && i < n_files; i++) {
+        if (writer_add_entry(w, names[i]) != 0) {
+            schedule_writer_discard(w);
+            return 1;
+        }
+    }
+    w->hdr.n_rows = 0;
+    return ferror(w->f) ? 1 : 0;
+}
+
+long schedule_writer_add_file(ScheduleWriter *w, const char *name) {
+    if (w->clock_f == w->f || writer_add_entry(w, name) != 0) return -1;
+    return (long)w->hdr.n_files++;
+}
+
+// Write out the segment being fitted
+static int writer_emit_clock(ScheduleWriter *w) {
+    if (w->cur.n_frames == 0) return 0;
+    // Any period in the feasible interval keeps all frames within the
+    // tolerance; take the middle
+    w->cur.period_ns = w->cur.n_frames > 1 ? 0.5 * (w->period_lo + w->period_hi) : 0.0;
+    if (fwrite(&w->cur, sizeof(w->cur), 1, w->clock_f) != 1) return 1;
+    w->hdr.n_clocks++;
+    w->fit_end_ns = w->cur.t_end_ns + llround((w->cur.n_frames - 1) * w->cur.period_ns);
+    w->cur.n_frames = 0;
+    return 0;
+}
+
+int schedule_writer_add(ScheduleWriter *w, const ScheduleFrame *frame) {
+    ScheduleClock *c = &w->cur;
+
+    if (c->n_frames > 0 && frame->file_id == c->file_id && frame->l_idx == c->l_idx + c->n_frames) {
+        // Frame j must end within the tolerance of t_end_ns + j * period:
+        // narrow the interval of periods that satisfy all frames so far
+        long j = c->n_frames;
+        double d = (double)(frame->t_end_ns - c->t_end_ns);
+        double lo = (d - w->jitter_ns) / j;
+        double hi = (d + w->jitter_ns) / j;
+        if (lo < w->period_lo) lo = w->period_lo;
+        if (hi > w->period_hi) hi = w->period_hi;
+        if (lo <= hi) {
+            w->period_lo = lo;
+            w->period_hi = hi;
+            c->n_frames++;
+            w->hdr.n_rows++;
+            w->last_end_ns = frame->t_end_ns;
+            return 0;
+        }
+    }
+
+    // Gap, new file or jitter above tolerance: start a new segment
+    int contiguous = (c->n_frames > 0 && frame->t_start_ns == w->last_end_ns);
+    if (writer_emit_clock(w) != 0) return 1;
+    c->file_id = frame->file_id;
+    c->l_idx = frame->l_idx;
+    c->n_frames = 1;
+    // Start where the previous segment's fitted frames end, so that
+    // consecutive frames neither overlap nor leave a gap
+    c->t_start_ns = contiguous ? w->fit_end_ns : frame->t_start_ns;
+    c->t_end_ns = frame->t_end_ns;
+    w->last_end_ns = frame->t_end_ns;
+    w->period_lo = 0.0;
+    w->period_hi = HUGE_VAL;
+    w->hdr.n_rows++;
+    return 0;
+}
+
+int schedule_writer_close(ScheduleWriter *w) {
+    int err = writer_emit_clock(w);
+    if (w->clock_f != w->f) {
+        // Segments go after the file table, now complete
+        char buf[65536];
+        size_t n;
+        if (fflush(w->clock_f) != 0 || fseek(w->clock_f, 0, SEEK_SET) != 0) err = 1;
+        while (!err && (n = fread(buf, 1, sizeof(buf), w->clock_f)) > 0) {
+            if (fwrite(buf, 1, n, w->f) != n) err = 1;
+        }
+        if (ferror(w->clock_f)) err = 1;
+        fclose(w->clock_f);
+        w->clock_f = w->f;
+    }
+    // A memory stream publishes its buffer on flush
+    if (fflush(w->f) != 0) err = 1;
+    if (w->mem) {
+        // Memory streams are truncated at the position of a seek: patch
+        // the header in the buffer instead
+        if (fclose(w->f) != 0 || w->mem_len < sizeof(w->hdr)) err = 1;
+        else memcpy(w->mem, &w->hdr, sizeof(w->hdr));
+    } else {
+        if (fseek(w->f, 0, SEEK_SET) != 0) err = 1;
+        if (fwrite(&w->hdr, sizeof(w->hdr), 1, w->f) != 1) err = 1;
+        if (fclose(w->f) != 0) err = 1;
+    }
+    w->f = NULL;
+    w->clock_f = NULL;
+    return err;
+}
+
+void schedule_writer_discard(ScheduleWriter *w) {
+    if (w->clock_f && w->clock_f != w->f) fclose(w->clock_f);
+    if (w->f) fclose(w->f);
+    free(w->mem);
+    w->f = NULL;
+    w->clock_f = NULL;
+    w->mem = NULL;
+    w->mem_len = 0;
+}
+
+// Check a complete schedule of len bytes at base. Returns an error message,
+// NULL if it can be used.
+static const char *check_schedule(const void *base, size_t len) {
+    const ScheduleHeader *hdr = (const ScheduleHeader *)base;
+    if (len < sizeof(ScheduleHeader)) return "truncated schedule header";
+    if (hdr->byte_order != SCHEDULE_BYTE_ORDER) return "written on a host with a different byte order";
+    if (hdr->version != SCHEDULE_VERSION || hdr->header_bytes != sizeof(ScheduleHeader)
+        || hdr->file_bytes != sizeof(ScheduleFileEntry) || hdr->clock_bytes != sizeof(ScheduleClock)) {
+        return "unsupported schedule version";
+    }
+    if (hdr->n_rows < 0 || hdr->n_files < 0 || hdr->n_clocks < 0) return "incomplete schedule (mkts did not finish)";
+    if (len < sizeof(ScheduleHeader) + (size_t)hdr->n_files * sizeof(ScheduleFileEntry)
+                  + (size_t)hdr->n_clocks * sizeof(ScheduleClock)) {
+        return "truncated schedule";
+    }
+
+    // Readers index the file table with file_id and stop at the first frame
+    // past their range, so the clock segments must be ordered in time
+    const ScheduleClock *clocks = (const ScheduleClock *)((const char *)base + sizeof(ScheduleHeader)
+                                                          + (size_t)hdr->n_files * sizeof(ScheduleFileEntry));
+    int64_t prev_start = INT64_MIN;
+    int64_t prev_end = INT64_MIN;
+    int64_t n_rows = 0;
+    for (int64_t k = 0; k < hdr->n_clocks; k++) {
+        const ScheduleClock *c = &clocks[k];
+        if ((int64_t)c->file_id >= hdr->n_files) return "clock segment refers to a file outside the file table";
+        if (c->n_frames < 1 || !(c->period_ns >= 0.0) || c->t_end_ns < c->t_start_ns) {
+            return "invalid clock segment";
+        }
+        int64_t end = c->t_end_ns + llround((c->n_frames - 1) * c->period_ns);
+        if (c->t_start_ns < prev_start || end < prev_end) return "clock segments are not ordered in time";
+        prev_start = c->t_start_ns;
+        prev_end = end;
+        n_rows += c->n_frames;
+    }
+    if (n_rows != hdr->n_rows) return "frame count does not match the clock segments";
+    return NULL;
+}
+
+static void map_sections(ScheduleMap *m, void *base, size_t len) {
+    m->base = base;
+    m->len = len;
+    m->hdr = (const ScheduleHeader *)base;
+    m->files = (const ScheduleFileEntry *)((const char *)base + sizeof(ScheduleHeader));
+    m->clocks = (const ScheduleClock *)(m->files + m->hdr->n_files);
+}
+
+int schedule_map_open(ScheduleMap *m, const char *path) {
+    memset(m, 0, sizeof(*m));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 1;
+
+    char magic[8];
+    struct stat st;
+    if (read(fd, magic, sizeof(magic)) != (ssize_t)sizeof(magic) || memcmp(magic, SCHEDULE_MAGIC, sizeof(magic)) != 0
+        || fstat(fd, &st) != 0) {
+        close(fd);
+        return 1;
+    }
+
+    size_t len = (size_t)st.st_size;
+    if (len < sizeof(ScheduleHeader)) {
+        fprintf(stderr, "Error: %s: truncated schedule header\n", path);
+        close(fd);
+        return -1;
+    }
+    void *base = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Error: could not map %s\n", path);
+        return -1;
+    }
+    madvise(base, len, MADV_SEQUENTIAL);
+
+    const char *err = check_schedule(base, len);
+    if (err) {
+        fprintf(stderr, "Error: %s: %s\n", path, err);
+        munmap(base, len);
+        return -1;
+    }
+
+    map_sections(m, base, len);
+    return 0;
+}
+
+int schedule_map_memory(ScheduleMap *m, ScheduleWriter *w) {
+    memset(m, 0, sizeof(*m));
+    const char *err = check_schedule(w->mem, w->mem_len);
+    if (err) {
+        fprintf(stderr, "Error: in-memory schedule: %s\n", err);
+        free(w->mem);
+        w->mem = NULL;
+        return -1;
+    }
+
+    map_sections(m, w->mem, w->mem_len);
+    m->owned = 1;
+    w->mem = NULL;
+    w->mem_len = 0;
+    return 0;
+}
+
+void schedule_map_close(ScheduleMap *m) {
+    if (m->base) {
+        if (m->owned) free(m->base);
+        else munmap(m->base, m->len);
+    }
+    memset(m, 0, sizeof(*m));
+}
+
+void schedule_clock_frame(const ScheduleMap *m, const ScheduleClock *c, long j, ScheduleFrame *frame) {
+    frame->file_id = c->file_id;
+    frame->l_idx = c->l_idx + (int32_t)j;
+    frame->t_start_ns = j > 0 ? c->t_end_ns + llround((j - 1) * c->period_ns) : c->t_start_ns;
+    frame->t_end_ns = c->t_end_ns + llround(j * c->period_ns);
+    // Differences to the origin are exact in int64, and small enough to
+    // convert to double without losing precision
+    double to_r = 1e-9 / m->hdr->dt;
+    frame->r_start = (double)(frame->t_start_ns - m->hdr->tstart_ns) * to_r;
+    frame->r_end = (double)(frame->t_end_ns - m->hdr->tstart_ns) * to_r;
+}
+
+void schedule_iter_init(ScheduleIter *it, const ScheduleMap *m) {
+    it->map = m;
+    it->clock = 0;
+    it->j = 0;
+}
+
+int schedule_iter_next(ScheduleIter *it, ScheduleFrame *frame) {
+    while (it->clock < it->map->hdr->n_clocks) {
+        const ScheduleClock *c = &it->map->clocks[it->clock];
+        if (it->j < c->n_frames) {
+            schedule_clock_frame(it->map, c, it->j++, frame);
+            return 1;
+        }
+        it->clock++;
+        it->j = 0;
+    }
+    return 0;
+}
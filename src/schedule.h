@@ -0,0 +1,162 @@
+#ifndef MILK_RESAMPLE_SCHEDULE_H
+#define MILK_RESAMPLE_SCHEDULE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "milkresample_export.h"
+
+// Binary resample schedule written by mkts and read by applyts.
+//
+// Layout (native byte order, checked through byte_order):
+//   ScheduleHeader
+//   ScheduleFileEntry[n_files]   source timing files, referenced by file_id
+//   ScheduleClock[n_clocks]      runs of regularly clocked frames, ordered in time
+//
+// Frames are not stored individually: consecutive frames of one file whose
+// end times lie on a line t_end = t0 + j * period (within the jitter
+// tolerance) form one clock segment, and frame times are computed from it.
+// Gaps, file changes and jitter above the tolerance start a new segment,
+// so the size is O(files + gaps) rather than O(frames).
+//
+// The fit is lossy by design: a frame time computed from its segment may
+// differ from the timing file by up to the jitter tolerance (1 us by
+// default in mkts), so it need not match the text export to the ns. A
+// tolerance of 0 keeps every frame time exact.
+//
+// All sections have fixed-size entries, so the file can be memory-mapped
+// and used in place. n_rows is -1 until the writer has completed the file.
+
+#define SCHEDULE_MAGIC "MILKRSMP"
+#define SCHEDULE_VERSION 2
+#define SCHEDULE_BYTE_ORDER 0x01020304u
+#define SCHEDULE_NAME_LEN 248
+
+typedef struct {
+    char magic[8];          // SCHEDULE_MAGIC, not NUL terminated
+    uint32_t version;       // SCHEDULE_VERSION
+    uint32_t byte_order;    // SCHEDULE_BYTE_ORDER as written by the producer
+    uint32_t header_bytes;  // sizeof(ScheduleHeader)
+    uint32_t file_bytes;    // sizeof(ScheduleFileEntry)
+    uint32_t clock_bytes;   // sizeof(ScheduleClock)
+    uint32_t reserved;
+    int64_t n_files;
+    int64_t n_clocks;
+    int64_t n_rows;         // Number of frames, -1 while being written
+    int64_t tstart_ns;      // Resampled time origin (Unix ns)
+    double dt;              // Resampled time unit (sec)
+    double jitter;          // Tolerance used to fit the clock segments (sec)
+    double max_r_end;       // Largest resampled end time
+    double max_span;        // Widest input frame, in output frames
+    int64_t naxis1;         // Input frame geometry, 0 if unknown
+    int64_t naxis2;
+} ScheduleHeader;
+
+typedef struct {
+    char name[SCHEDULE_NAME_LEN];  // Timing file name (no directory), NUL terminated
+    int64_t reserved;
+} ScheduleFileEntry;
+
+// Frames l_idx .. l_idx + n_frames - 1 of one file. Frame j ends at
+// t_end_ns + j * period_ns and starts where frame j - 1 ends; frame 0
+// starts at t_start_ns.
+typedef struct {
+    uint32_t file_id;       // Index into the file table
+    int32_t l_idx;          // Local index of the first frame (0-based)
+    int64_t n_frames;
+    int64_t t_start_ns;     // Start time of the first frame (Unix ns)
+    int64_t t_end_ns;       // End time of the first frame (Unix ns)
+    double period_ns;       // Frame period (ns), 0 for a single frame
+} ScheduleClock;
+
+// One frame of the schedule
+typedef struct {
+    uint32_t file_id;       // Index into the file table
+    int32_t l_idx;          // Frame index within the source file (0-based)
+    int64_t t_start_ns;     // Frame start time (Unix ns)
+    int64_t t_end_ns;       // Frame end time (Unix ns)
+    double r_start;         // Resampled start time
+    double r_end;           // Resampled end time
+} ScheduleFrame;
+
+// Streaming writer: the file table is written up front, frames are fitted
+// into clock segments as they are added, and the header is completed by
+// schedule_writer_close(). The file table may instead be built as files
+// are found (schedule_writer_add_file); the segments are then kept in a
+// temporary file and copied after the table on close.
+typedef struct {
+    FILE *f;
+    FILE *clock_f;          // Segments are written here: f, or the temporary file
+    ScheduleHeader hdr;
+    int64_t jitter_ns;      // Tolerance for frames to join a segment
+    // Segment being fitted
+    ScheduleClock cur;
+    double period_lo;       // Feasible period interval (ns)
+    double period_hi;
+    int64_t last_end_ns;    // Actual end of the last frame added
+    int64_t fit_end_ns;     // End of the last frame of the previous segment, as fitted
+    // Schedule built in memory (path NULL), valid after close
+    char *mem;
+    size_t mem_len;
+} ScheduleWriter;
+
+// Create path with the given file table, or build the schedule in memory if
+// path is NULL. Frames may deviate from their clock segment by up to jitter
+// seconds (0: exact). With names NULL (and n_files 0), files are added with
+// schedule_writer_add_file() instead. Returns 0 on success.
+MILKRESAMPLE_API int schedule_writer_open(ScheduleWriter *w, const char *path, const char *const *names, long n_files,
+                         double tstart, double dt, double jitter);
+
+// Append a file to the table of a writer opened without names. Returns its
+// file_id, or -1 on error (an error has been printed).
+MILKRESAMPLE_API long schedule_writer_add_file(ScheduleWriter *w, const char *name);
+
+// Append one frame (r_start/r_end are not used). Returns 0 on success.
+MILKRESAMPLE_API int schedule_writer_add(ScheduleWriter *w, const ScheduleFrame *frame);
+
+// Write the final header (summary fields of w->hdr must be filled in) and
+// close the file. Returns 0 on success.
+MILKRESAMPLE_API int schedule_writer_close(ScheduleWriter *w);
+
+// Give up on an open writer, releasing everything (a file being written is
+// left incomplete: its n_rows stays -1)
+MILKRESAMPLE_API void schedule_writer_discard(ScheduleWriter *w);
+
+// Read-only mapping of a complete binary schedule
+typedef struct {
+    void *base;
+    size_t len;
+    int owned;              // base is a heap buffer rather than a file mapping
+    const ScheduleHeader *hdr;
+    const ScheduleFileEntry *files;
+    const ScheduleClock *clocks;
+} ScheduleMap;
+
+// Map a binary schedule.
+// Returns 0 on success, 1 if path is not a binary schedule (e.g. the text
+// format), -1 if it is a binary schedule that cannot be used (an error has
+// been printed).
+MILKRESAMPLE_API int schedule_map_open(ScheduleMap *m, const char *path);
+
+// Use the schedule built in memory by a closed writer. The map takes over
+// the buffer. Returns 0 on success, -1 on error (an error has been printed).
+MILKRESAMPLE_API int schedule_map_memory(ScheduleMap *m, ScheduleWriter *w);
+
+MILKRESAMPLE_API void schedule_map_close(ScheduleMap *m);
+
+// Frame j of clock segment c
+MILKRESAMPLE_API void schedule_clock_frame(const ScheduleMap *m, const ScheduleClock *c, long j, ScheduleFrame *frame);
+
+// Iterates over all frames of a schedule in time order
+typedef struct {
+    const ScheduleMap *map;
+    int64_t clock;          // Current clock segment
+    int64_t j;              // Next frame within it
+} ScheduleIter;
+
+MILKRESAMPLE_API void schedule_iter_init(ScheduleIter *it, const ScheduleMap *m);
+
+// Next frame of the schedule. Returns 1 if frame was filled in, 0 at the end.
+MILKRESAMPLE_API int schedule_iter_next(ScheduleIter *it, ScheduleFrame *frame);
+
+#endif
@@ -0,0 +1,670 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "fitsio.h"
+#include "telemetry.h"
+#include "timing.h"
+
+// Summary of a resample file, written at the top of its header so that
+// applyts can size its output without scanning all rows first
+typedef struct {
+    long n_rows;       // Number of rows (input frames), -1 until complete
+    double max_r_end;  // Largest resampled end time
+    double max_span;   // Widest input frame, in output frames
+    long naxis1;       // Input frame geometry, 0 if the FITS cube was not found
+    long naxis2;
+} ScheduleSummary;
+
+// Helper to check if string starts with prefix
+static int starts_with(const char *pre, const char *str) {
+    size_t lenpre = strlen(pre);
+    size_t lenstr = strlen(str);
+    return lenstr < lenpre ? 0 : strncmp(pre, str, lenpre) == 0;
+}
+
+// Helper to parse UT string: UTYYYYMMDDTHH:MM:SS.SSS
+double parse_ut_string(const char *ut_str) {
+    if (!starts_with("UT", ut_str)) return -1.0;
+
+    struct tm tm_val;
+    memset(&tm_val, 0, sizeof(struct tm));
+
+    // UTYYYYMMDDTHH:MM:SS.SSS
+    // 0123456789012345678901
+    // YYYY = 2-5
+    // MM = 6-7
+    // DD = 8-9
+    // HH = 11-12
+    // MM = 14-15
+    // SS = 17-18
+    // .SSS = 19...
+
+    // Use sscanf to parse parts
+    int year, month, day, hour, minute;
+    double seconds = 0.0;
+
+    // We handle the optional seconds part manually
+    char tmp[64];
+    strncpy(tmp, ut_str + 2, 63);
+    tmp[63] = '\0';
+
+    // Replace T with space for easier parsing
+    char *t_ptr = strchr(tmp, 'T');
+    if (t_ptr) *t_ptr = ' ';
+
+    int scanned = sscanf(tmp, "%4d%2d%2d %2d:%2d:%lf",
+                         &year, &month, &day, &hour, &minute, &seconds);
+
+    if (scanned < 5) return -1.0;
+
+    tm_val.tm_year = year - 1900;
+    tm_val.tm_mon = month - 1;
+    tm_val.tm_mday = day;
+    tm_val.tm_hour = hour;
+    tm_val.tm_min = minute;
+    tm_val.tm_sec = (int)seconds;
+
+    time_t raw_time = timegm(&tm_val);
+    if (raw_time == -1) return -1.0;
+
+    double fractional = seconds - (int)seconds;
+    return (double)raw_time + fractional;
+}
+
+double parse_time_arg(const char *tstr, double relative_to) {
+    if (starts_with("UT", tstr)) {
+        return parse_ut_string(tstr);
+    } else if (tstr[0] == '+') {
+        // Relative time
+        // Formats: +SS.SSSS, +MM:SS.SSSS, +HH:MM:SS.SSS
+        double offset = 0.0;
+        int h = 0, m = 0;
+        double s = 0.0;
+
+        // Count colons
+        int colons = 0;
+        const char *p = tstr;
+        while (*p) {
+            if (*p == ':') colons++;
+            p++;
+        }
+
+        if (colons == 0) {
+            // +SS.SSSS
+            s = atof(tstr + 1);
+        } else if (colons == 1) {
+            // +MM:SS.SSSS
+            sscanf(tstr + 1, "%d:%lf", &m, &s);
+            offset = m * 60.0 + s;
+            return relative_to + offset;
+        } else if (colons == 2) {
+            // +HH:MM:SS.SSS
+            sscanf(tstr + 1, "%d:%d:%lf", &h, &m, &s);
+            offset = h * 3600.0 + m * 60.0 + s;
+            return relative_to + offset;
+        }
+        return relative_to + s;
+    } else {
+        // Assume unix seconds
+        return atof(tstr);
+    }
+}
+
+void format_time(double t, char *buffer, size_t size) {
+    time_t raw_time = (time_t)t;
+    double frac = t - raw_time;
+    struct tm *tm_info = gmtime(&raw_time);
+
+    char tmp[64];
+    strftime(tmp, sizeof(tmp), "UT%Y%m%dT%H:%M:%S", tm_info);
+
+    // append fractional part
+    snprintf(buffer, size, "%s.%03d", tmp, (int)(frac * 1000 + 0.5));
+}
+
+void print_time_info(FILE *f, double tstart, double tend) {
+    char start_buf[64], end_buf[64];
+    format_time(tstart, start_buf, sizeof(start_buf));
+    format_time(tend, end_buf, sizeof(end_buf));
+
+    fprintf(f, "Time scan:\n");
+    fprintf(f, "  Start: %.4f (%s)\n", tstart, start_buf);
+    fprintf(f, "  End:   %.4f (%s)\n", tend, end_buf);
+    fprintf(f, "  Duration: %.4f s\n", tend - tstart);
+}
+
+// Parses time from filename like sname_HH:MM:SS.SSSSSSSSS.txt
+// We need the date from the directory context, so this function only returns seconds within the day
+double parse_filename_time(const char *filename) {
+    // Expected format: sname_HH:MM:SS.SSSSSSSSS.txt
+    // Find the underscore
+    const char *p = strrchr(filename, '_');
+    if (!p) return -1.0;
+    p++; // skip _
+
+    int h, m;
+    double s;
+    if (sscanf(p, "%d:%d:%lf", &h, &m, &s) < 3) return -1.0;
+
+    return h * 3600.0 + m * 60.0 + s;
+}
+
+// Unix ns as seconds with 6 decimals, rounded to the nearest us
+static void format_ns(int64_t ns, char *buffer, size_t size) {
+    int64_t us = ns >= 0 ? (ns + 500) / 1000 : -((-ns + 500) / 1000);
+    const char *sign = us < 0 ? "-" : "";
+    if (us < 0) us = -us;
+    snprintf(buffer, size, "%s%lld.%06lld", sign, (long long)(us / 1000000), (long long)(us % 1000000));
+}
+
+// Summary lines are fixed width: they are written with placeholder values
+// first and overwritten in place once all rows are known.
+static void write_schedule_summary(FILE *fout, const ScheduleSummary *sum) {
+    fprintf(fout, "# n_rows: %20ld\n", sum->n_rows);
+    fprintf(fout, "# max_r_end: %20.6lf\n", sum->max_r_end);
+    fprintf(fout, "# max_span: %20.6lf\n", sum->max_span);
+    fprintf(fout, "# naxis: %10ld %10ld\n", sum->naxis1, sum->naxis2);
+}
+
+int fits_path_for_timing_file(const char *txt_path, char *fits_path, size_t size) {
+    char base_path[MAX_PATH];
+
+    strncpy(base_path, txt_path, MAX_PATH - 1);
+    base_path[MAX_PATH - 1] = '\0';
+    char *ext = strrchr(base_path, '.');
+    if (ext && strcmp(ext, ".txt") == 0) *ext = '\0';
+
+    snprintf(fits_path, size, "%s.fits", base_path);
+    if (access(fits_path, F_OK) == 0) return 0;
+    snprintf(fits_path, size, "%s.fits.fz", base_path);
+    return access(fits_path, F_OK) == 0 ? 0 : 1;
+}
+
+int get_fits_geometry(const char *txt_path, long *naxis1, long *naxis2) {
+    char fits_path[MAX_PATH + 8];
+    if (fits_path_for_timing_file(txt_path, fits_path, sizeof(fits_path)) != 0) return 1;
+
+    fitsfile *fptr;
+    int status = 0;
+    int naxis = 0;
+    long naxes[3] = {0, 0, 0};
+    fits_open_file(&fptr, fits_path, READONLY, &status);
+    if (status) return 1;
+    fits_get_img_dim(fptr, &naxis, &status);
+    if (status == 0 && naxis == 0) {
+        // Compressed cubes keep their data in the first extension
+        int hdutype;
+        fits_movabs_hdu(fptr, 2, &hdutype, &status);
+        fits_get_img_dim(fptr, &naxis, &status);
+    }
+    fits_get_img_size(fptr, 3, naxes, &status);
+    int close_status = 0;
+    fits_close_file(fptr, &close_status);
+    if (status || naxis < 2) return 1;
+
+    *naxis1 = naxes[0];
+    *naxis2 = naxes[1];
+    return 0;
+}
+
+// Files parsed per batch and thread: enough to balance uneven file sizes
+#define LOAD_BATCH_PER_THREAD 4
+
+// Outcome of loading one file of a batch
+#define LOAD_READ 0
+#define LOAD_FAILED 1
+#define LOAD_SUMMARY 2      // Ends before the range: its last row comes from the day index
+#define LOAD_NOMEM 3        // Out of memory (an error has been printed)
+
+// A batch of timing files parsed by a pool of threads
+typedef struct {
+    const FileCatalog *cat;
+    int first;              // First file of the batch
+    int n;                  // Files in the batch
+    int next;               // Next file to claim (atomic)
+    int64_t t_lo;           // Range of interest (ns)
+    int64_t t_hi;
+    TimingRows *rows;       // Per file of the batch
+    int *status;            // LOAD_* per file
+} LoadBatch;
+
+// Rows of a file that ends at or before t_lo according to its day index
+// summary, as timing_load_rows() would return them, without opening it
+static int rows_from_summary(const FileEntry *e, TimingRows *rows) {
+    memset(rows, 0, sizeof(*rows));
+    rows->l_idx = (int32_t *)malloc(sizeof(int32_t));
+    rows->t_ns = (int64_t *)malloc(sizeof(int64_t));
+    if (!rows->l_idx || !rows->t_ns) {
+        fprintf(stderr, "Error: out of memory for the timing rows\n");
+        timing_rows_free(rows);
+        return LOAD_NOMEM;
+    }
+    // Only the end time is used: the frame ends before the range
+    rows->l_idx[0] = e->n_frames - 1;
+    rows->t_ns[0] = e->last_ns;
+    rows->n_rows = 1;
+    rows->cap = 1;
+    rows->tail_only = 1;
+    return LOAD_SUMMARY;
+}
+
+static void *load_worker(void *arg) {
+    LoadBatch *lb = (LoadBatch *)arg;
+    for (;;) {
+        int k = __atomic_fetch_add(&lb->next, 1, __ATOMIC_RELAXED);
+        if (k >= lb->n) break;
+        const FileEntry *e = &lb->cat->files[lb->first + k];
+        if (e->n_frames >= 0 && e->last_ns <= lb->t_lo) {
+            lb->status[k] = rows_from_summary(e, &lb->rows[k]);
+            continue;
+        }
+        char path[MAX_PATH];
+        if (catalog_path(lb->cat, lb->first + k, path, sizeof(path)) != 0) {
+            lb->status[k] = LOAD_FAILED;
+            continue;
+        }
+        int load_status = timing_load_rows(path, lb->t_lo, lb->t_hi, &lb->rows[k]);
+        lb->status[k] = load_status == 0 ? LOAD_READ : load_status < 0 ? LOAD_NOMEM : LOAD_FAILED;
+    }
+    return NULL;
+}
+
+// Parse all files of the batch; the calling thread takes part
+static void load_batch(LoadBatch *lb, int n_threads) {
+    lb->next = 0;
+    int n_extra = n_threads - 1;
+    if (n_extra > lb->n - 1) n_extra = lb->n - 1;
+    pthread_t *threads = NULL;
+    int n_started = 0;
+    if (n_extra > 0) {
+        threads = (pthread_t *)malloc(n_extra * sizeof(pthread_t));
+        for (; threads && n_started < n_extra; n_started++) {
+            if (pthread_create(&threads[n_started], NULL, load_worker, lb) != 0) break;
+        }
+    }
+    load_worker(lb);
+    for (int t = 0; t < n_started; t++) pthread_join(threads[t], NULL);
+    free(threads);
+}
+
+// Seconds between progress reports on a terminal, and in a log
+#define PROGRESS_INTERVAL_TTY 1.0
+#define PROGRESS_INTERVAL_LOG 30.0
+
+// Progress of a schedule build, reported on stderr once it takes a while
+typedef struct {
+    double t0;              // Monotonic start time [s]
+    double t_shown;         // Time of the last report, 0 if none yet
+    int64_t bytes;          // Size of the timing files processed
+    int tty;
+} Progress;
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// fraction is the part of the range covered. The total size is extrapolated
+// from the bytes processed so far, assuming a steady data rate over the range.
+static void progress_report(Progress *p, double fraction, int final) {
+    double now = monotonic_seconds();
+    if (final) {
+        if (p->t_shown == 0) return;
+        fraction = 1.0;
+    } else if (now - (p->t_shown > 0 ? p->t_shown : p->t0) < (p->tty ? PROGRESS_INTERVAL_TTY : PROGRESS_INTERVAL_LOG)) {
+        return;
+    }
+    if (fraction < 0) fraction = 0;
+    if (fraction > 1) fraction = 1;
+    double elapsed = now - p->t0;
+    double rate = elapsed > 0 ? p->bytes / elapsed : 0.0;
+    char eta[32] = "--:--:--";
+    if (fraction > 0 && rate > 0) {
+        long s = lround((p->bytes / fraction - p->bytes) / rate);
+        snprintf(eta, sizeof(eta), "%02ld:%02ld:%02ld", s / 3600, s / 60 % 60, s % 60);
+    }
+    fprintf(stderr, "%sProgress: %5.1f%% of the range, %.1f MB at %.1f MB/s, ETA %s%s", p->tty ? "\r" : "",
+            100.0 * fraction, p->bytes * 1e-6, rate * 1e-6, eta, p->tty && !final ? "" : "\n");
+    p->t_shown = now;
+}
+
+// Schedule being built from the timing files, a catalog at a time
+typedef struct {
+    char out_filename[MAX_PATH];
+    char txt_filename[MAX_PATH];
+    ScheduleWriter sw;
+    FILE *fout;
+    long summary_offset;
+    ScheduleSummary sum;
+    int geometry_checked;
+    int frame_index;
+    int n_threads;
+    // Times are kept in integer ns: Unix seconds in a double are only
+    // resolved to ~0.24 us
+    int64_t tstart_ns;
+    int64_t tend_ns;
+    double ns_to_r;
+    int have_prev;
+    int64_t prev_end_ns;
+    int batch_size;
+    LoadBatch lb;
+    long rows_skipped;
+    int n_tail_read;
+    int n_summary;
+    int n_after_tend;       // Files skipped through the summaries
+    int after_tend;         // Later files are after tend according to the summaries
+    int past_tend;
+    int write_err;
+    int scan_err;           // The scan or a file load failed (error already printed)
+    FILE *log;              // Summary of the build, NULL: none (and no progress)
+    Progress progress;
+} ScheduleBuild;
+
+// Open the outputs. With cat NULL, files are added to the table as they
+// come (schedule_writer_add_file). Returns 0 on success.
+static int build_open(ScheduleBuild *b, const FileCatalog *cat, const char *sname, double tstart, double tend,
+                      double dt, double jitter, int n_threads, int write_text, int in_memory, FILE *log) {
+    memset(b, 0, sizeof(*b));
+    b->log = log;
+    if (in_memory) snprintf(b->out_filename, MAX_PATH, "in-memory schedule");
+    else snprintf(b->out_filename, MAX_PATH, "%s.resample.bin", sname);
+    snprintf(b->txt_filename, MAX_PATH, "%s.resample.txt", sname);
+
+    // Binary schedule: the file table holds every scanned file, records
+    // refer to it by index
+    int err;
+    if (cat) {
+        int count = cat->count;
+        const char **names = malloc((count > 0 ? count : 1) * sizeof(char *));
+        if (!names) {
+            fprintf(stderr, "Error: out of memory for the file table\n");
+            return 1;
+        }
+        for (int i = 0; i < count; i++) {
+            names[i] = catalog_name(cat, i);
+        }
+        err = schedule_writer_open(&b->sw, in_memory ? NULL : b->out_filename, names, count, tstart, dt, jitter);
+        free(names);
+    } else {
+        err = schedule_writer_open(&b->sw, in_memory ? NULL : b->out_filename, NULL, 0, tstart, dt, jitter);
+    }
+    if (err) return 1;
+
+    ScheduleSummary sum = {-1, 0.0, 0.0, 0, 0};
+    b->sum = sum;
+    if (write_text) {
+        b->fout = fopen(b->txt_filename, "w");
+        if (!b->fout) {
+            fprintf(stderr, "Error opening output file %s\n", b->txt_filename);
+            schedule_writer_discard(&b->sw);
+            return 1;
+        }
+
+        // Output headers
+        fprintf(b->fout, "# Telemetry resampled data\n");
+
+        b->summary_offset = ftell(b->fout);
+        write_schedule_summary(b->fout, &b->sum);
+
+        fprintf(b->fout, "# col1: Global frame index\n");
+        fprintf(b->fout, "# col2: Frame start time (Unix sec)\n");
+        fprintf(b->fout, "# col3: Frame end time (Unix sec)\n");
+        fprintf(b->fout, "# col4: Source filename\n");
+        fprintf(b->fout, "# col5: Local frame index\n");
+        fprintf(b->fout, "# col6: Resampled start time\n");
+        fprintf(b->fout, "# col7: Resampled end time\n");
+    }
+    b->sum.n_rows = 0;
+
+    b->tstart_ns = b->sw.hdr.tstart_ns;
+    b->tend_ns = b->tstart_ns + llround((tend - tstart) * 1e9);
+    b->ns_to_r = 1e-9 / dt;
+    b->n_threads = n_threads;
+
+    // Files are mapped and parsed in parallel, a batch at a time so that
+    // memory stays bounded; frames are then stitched in time order, which
+    // is the only step that needs the previous file's last frame
+    b->batch_size = n_threads * LOAD_BATCH_PER_THREAD;
+    b->lb.rows = (TimingRows *)calloc(b->batch_size, sizeof(TimingRows));
+    b->lb.status = (int *)calloc(b->batch_size, sizeof(int));
+    if (!b->lb.rows || !b->lb.status) {
+        fprintf(stderr, "Error: out of memory for the timing files\n");
+        free(b->lb.rows);
+        free(b->lb.status);
+        if (b->fout) fclose(b->fout);
+        schedule_writer_discard(&b->sw);
+        return 1;
+    }
+    b->lb.t_lo = b->tstart_ns;
+    b->lb.t_hi = b->tend_ns;
+
+    b->progress.t0 = monotonic_seconds();
+    b->progress.tty = isatty(STDERR_FILENO);
+    return 0;
+}
+
+// Add the frames of the files of cat, whose file_ids start at id_base
+static void build_files(ScheduleBuild *b, const FileCatalog *cat, long id_base) {
+    int count = cat->count;
+    LoadBatch *lb = &b->lb;
+    lb->cat = cat;
+
+    // The first frame of a file starts where the previous file ends: after
+    // a file ending at or after tend, no file can hold a frame of the range.
+    // With the day index summaries, they need not be opened at all.
+    int n_load = b->after_tend ? 0 : count;
+    for (int i = 0; i < n_load; i++) {
+        const FileEntry *e = &cat->files[i];
+        if (e->n_frames >= 0 && e->last_ns >= b->tend_ns) {
+            n_load = i + 1;
+            b->after_tend = 1;
+            break;
+        }
+    }
+    b->n_after_tend += count - n_load;
+
+    for (int first = 0; first < n_load && !b->past_tend && !b->write_err && !b->scan_err; first += b->batch_size) {
+        lb->first = first;
+        lb->n = n_load - first < b->batch_size ? n_load - first : b->batch_size;
+        load_batch(lb, b->n_threads);
+
+        for (int k = 0; k < lb->n; k++) {
+            int i = first + k;
+            TimingRows *rows = &lb->rows[k];
+            char path[MAX_PATH];
+            catalog_path(cat, i, path, sizeof(path));
+            if (b->past_tend || b->write_err || b->scan_err) {
+                timing_rows_free(rows);
+                continue;
+            }
+            if (lb->status[k] == LOAD_NOMEM) {
+                b->scan_err = 1;
+                continue;
+            }
+            if (lb->status[k] == LOAD_FAILED) {
+                fprintf(stderr, "Warning: Could not open input file %s\n", path);
+                continue;
+            }
+            b->rows_skipped += rows->n_skipped;
+            b->progress.bytes += (int64_t)rows->file_bytes;
+            if (lb->status[k] == LOAD_SUMMARY) b->n_summary++;
+            else if (rows->tail_only) b->n_tail_read++;
+
+            const char *filename_only = catalog_name(cat, i);
+
+            // col1: frame index, col5: absolute time (acquisition), the end of the frame
+            for (long r = 0; r < rows->n_rows; r++) {
+                int32_t l_idx = rows->l_idx[r];
+                int64_t end_ns = rows->t_ns[r];
+                if (!b->have_prev) {
+                    // First frame ever encountered.
+                    // We don't have a start time for this frame.
+                    // We'll skip outputting it, but we set prev_end_ns so the NEXT frame is valid.
+                    b->have_prev = 1;
+                    b->prev_end_ns = end_ns;
+                    continue;
+                }
+
+                int64_t start_ns = b->prev_end_ns;
+                if (start_ns >= b->tend_ns) {
+                    // Times increase: no later row can overlap
+                    b->past_tend = 1;
+                    break;
+                }
+
+                // Overlap: [start, end] overlaps [tstart, tend]
+                if (start_ns < b->tend_ns && end_ns > b->tstart_ns) {
+                    double resampled_start = (double)(start_ns - b->tstart_ns) * b->ns_to_r;
+                    double resampled_end = (double)(end_ns - b->tstart_ns) * b->ns_to_r;
+
+                    ScheduleFrame frame;
+                    frame.file_id = (uint32_t)(id_base + i);
+                    frame.l_idx = l_idx;
+                    frame.t_start_ns = start_ns;
+                    frame.t_end_ns = end_ns;
+                    if (schedule_writer_add(&b->sw, &frame) != 0) {
+                        b->write_err = 1;
+                        break;
+                    }
+
+                    if (b->fout) {
+                        char start_str[32], end_str[32];
+                        format_ns(start_ns, start_str, sizeof(start_str));
+                        format_ns(end_ns, end_str, sizeof(end_str));
+                        fprintf(b->fout, "%d %s %s %s %d %.6lf %.6lf\n",
+                                b->frame_index,
+                                start_str,
+                                end_str,
+                                filename_only,
+                                (int)l_idx,
+                                resampled_start,
+                                resampled_end);
+                    }
+
+                    b->frame_index++;
+
+                    ScheduleSummary *sum = &b->sum;
+                    sum->n_rows++;
+                    if (resampled_end > sum->max_r_end) sum->max_r_end = resampled_end;
+                    if (resampled_end - resampled_start > sum->max_span) sum->max_span = resampled_end - resampled_start;
+                    if (!b->geometry_checked) {
+                        b->geometry_checked = 1;
+                        if (get_fits_geometry(path, &sum->naxis1, &sum->naxis2) != 0) {
+                            fprintf(stderr, "Warning: no FITS cube found for %s, frame size not recorded\n", path);
+                        }
+                    }
+                }
+
+                b->prev_end_ns = end_ns;
+            }
+            timing_rows_free(rows);
+        }
+        double covered = b->tend_ns > b->tstart_ns
+                             ? (double)(b->prev_end_ns - b->tstart_ns) / (double)(b->tend_ns - b->tstart_ns) : 0.0;
+        if (b->log) progress_report(&b->progress, covered, 0);
+    }
+}
+
+// Complete the outputs. Returns 0 on success.
+static int build_close(ScheduleBuild *b, ScheduleMap *sched, double jitter) {
+    free(b->lb.rows);
+    free(b->lb.status);
+    if (b->log) progress_report(&b->progress, 1.0, 1);
+
+    if (b->write_err || b->scan_err) {
+        if (b->write_err) fprintf(stderr, "Error writing %s\n", b->out_filename);
+        if (b->fout) fclose(b->fout);
+        schedule_writer_discard(&b->sw);
+        return 1;
+    }
+    FILE *log = b->log;
+    if (log) {
+        if (b->n_summary > 0) fprintf(log, "%d file(s) ending before tstart: skipped using the day index\n", b->n_summary);
+        if (b->n_tail_read > 0) fprintf(log, "%d file(s) ending before tstart: only their last row was read\n", b->n_tail_read);
+        if (b->n_after_tend > 0) fprintf(log, "%d file(s) after tend: skipped using the day index\n", b->n_after_tend);
+        if (b->rows_skipped > 0) fprintf(log, "Skipped %ld rows before tstart by seeking\n", b->rows_skipped);
+    }
+
+    // Fill in the summary now that all rows are known
+    ScheduleWriter *sw = &b->sw;
+    sw->hdr.max_r_end = b->sum.max_r_end;
+    sw->hdr.max_span = b->sum.max_span;
+    sw->hdr.naxis1 = b->sum.naxis1;
+    sw->hdr.naxis2 = b->sum.naxis2;
+    if (schedule_writer_close(sw) != 0) {
+        fprintf(stderr, "Error writing %s\n", b->out_filename);
+        if (b->fout) fclose(b->fout);
+        free(sw->mem);
+        return 1;
+    }
+    if (sched) {
+        if (schedule_map_memory(sched, sw) != 0) {
+            if (b->fout) fclose(b->fout);
+            return 1;
+        }
+        if (log) {
+            fprintf(log, "Schedule built in memory (%ld frames in %ld clock segments, jitter tolerance %g s)\n",
+                    b->sum.n_rows, (long)sw->hdr.n_clocks, jitter);
+        }
+    } else if (log) {
+        fprintf(log, "Output written to %s (%ld frames in %ld clock segments, jitter tolerance %g s)\n",
+                b->out_filename, b->sum.n_rows, (long)sw->hdr.n_clocks, jitter);
+    }
+
+    if (b->fout) {
+        fseek(b->fout, b->summary_offset, SEEK_SET);
+        write_schedule_summary(b->fout, &b->sum);
+
+        fclose(b->fout);
+        if (log) fprintf(log, "Output written to %s\n", b->txt_filename);
+    }
+    return 0;
+}
+
+int process_telemetry(const FileCatalog *cat, const char *sname, double tstart, double tend, double dt,
+                      double jitter, int n_threads, int write_text, ScheduleMap *sched, FILE *log) {
+    ScheduleBuild b;
+    if (build_open(&b, cat, sname, tstart, tend, dt, jitter, n_threads, write_text, sched != NULL, log) != 0) {
+        return 1;
+    }
+    build_files(&b, cat, 0);
+    return build_close(&b, sched, jitter);
+}
+
+int process_telemetry_stream(ScanStream *scan, double dt, double jitter, int n_threads, int write_text,
+                             ScheduleMap *sched) {
+    ScheduleBuild b;
+    if (build_open(&b, NULL, scan->sname, scan->tstart, scan->tend, dt, jitter, n_threads, write_text,
+                   sched != NULL, scan->log) != 0) {
+        return 1;
+    }
+
+    // One catalog per step of the scan: the files of a few days
+    long n_files = 0;
+    while (!b.write_err && !b.scan_err) {
+        FileCatalog chunk;
+        catalog_init(&chunk);
+        int n = scan_stream_next(scan, &chunk);
+        if (n < 0) {
+            b.scan_err = 1;
+            catalog_free(&chunk);
+            break;
+        }
+        if (n > 0 && scan->log) catalog_print(&chunk, scan->log);
+        for (int i = 0; i < n && !b.write_err; i++) {
+            if (schedule_writer_add_file(&b.sw, catalog_name(&chunk, i)) < 0) b.write_err = 1;
+        }
+        if (n > 0 && !b.write_err) build_files(&b, &chunk, n_files);
+        n_files += n;
+        catalog_free(&chunk);
+        if (n == 0) break;
+    }
+    return build_close(&b, sched, jitter);
+}
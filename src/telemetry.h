@@ -0,0 +1,52 @@
+#ifndef MILK_RESAMPLE_TELEMETRY_H
+#define MILK_RESAMPLE_TELEMETRY_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "schedule.h"
+#include "catalog.h"
+#include "milkresample_export.h"
+
+// Telemetry scan: finds the timing files of a stream that overlap a time
+// range and turns their frames into a resample schedule. Used by mkts and
+// by the one-shot resample tool.
+
+#define MAX_PATH 1024
+
+// Default jitter tolerance when fitting frames to clock segments [s]: frame
+// times in the binary schedule may be off by this much (see schedule.h)
+#define DEFAULT_JITTER 1e-6
+
+MILKRESAMPLE_API double parse_time_arg(const char *tstr, double relative_to);
+MILKRESAMPLE_API double parse_ut_string(const char *ut_str);
+MILKRESAMPLE_API double parse_filename_time(const char *filename);
+// Write the range and its duration to f
+MILKRESAMPLE_API void print_time_info(FILE *f, double tstart, double tend);
+MILKRESAMPLE_API void format_time(double t, char *buffer, size_t size);
+
+// FITS cube (.fits or .fits.fz) next to a timing file. Returns 0 if found.
+MILKRESAMPLE_API int fits_path_for_timing_file(const char *txt_path, char *fits_path, size_t size);
+
+// Frame size of the FITS cube next to a timing file. Returns 0 on success.
+MILKRESAMPLE_API int get_fits_geometry(const char *txt_path, long *naxis1, long *naxis2);
+
+// Build the schedule of the frames in [tstart, tend] from the scanned files.
+// The schedule is written to <sname>.resample.bin, or kept in memory and
+// returned in sched if sched is not NULL. The file table holds every
+// file of the catalog in order, so file_id indexes it. With write_text, it is
+// also exported as <sname>.resample.txt. Timing files are parsed by
+// n_threads threads. A summary of the build is written to log, and
+// progress to stderr if it takes more than a second; with log NULL, only
+// errors and warnings are printed. Returns 0 on success.
+MILKRESAMPLE_API int process_telemetry(const FileCatalog *cat, const char *sname, double tstart, double tend, double dt,
+                                       double jitter, int n_threads, int write_text, ScheduleMap *sched, FILE *log);
+
+// Same as process_telemetry() for the files of a scan, taken from the stream
+// a few days at a time, so that memory does not grow with the length of
+// the range, except for the schedule itself if it is kept in memory. The
+// output is identical. Reports go to scan->log, which also gets the files
+// as they come (as catalog_print() lists them).
+MILKRESAMPLE_API int process_telemetry_stream(ScanStream *scan, double dt, double jitter, int n_threads, int write_text,
+                                              ScheduleMap *sched);
+
+#endif
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "timing.h"
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char *skip_blanks(const char *p, const char *end) {
+    while (p < end && is_blank(*p)) p++;
+    return p;
+}
+
+static const char *skip_token(const char *p, const char *end) {
+    while (p < end && !is_blank(*p)) p++;
+    return p;
+}
+
+// Fixed-point decimal [-]digits[.digits] to ns. Returns the end of the
+// number, NULL if the token has another form (exponent, too many digits).
+static const char *parse_decimal_ns(const char *p, const char *end, int64_t *ns) {
+    int neg = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+
+    int64_t sec = 0;
+    int n_int = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (++n_int > 10) return NULL;  // Beyond int64 ns
+        sec = sec * 10 + (*p++ - '0');
+    }
+
+    int64_t frac = 0;
+    int n_frac = 0;
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (n_frac < 9) {
+                frac = frac * 10 + (*p - '0');
+            } else if (n_frac == 9 && *p >= '5') {
+                frac++;  // Round to the nearest ns
+            }
+            n_frac++;
+            p++;
+        }
+    }
+    if (n_int + n_frac == 0) return NULL;
+    if (p < end && !is_blank(*p)) return NULL;
+
+    for (int i = n_frac; i < 9; i++) frac *= 10;
+    int64_t v = sec * 1000000000LL + frac;
+    *ns = neg ? -v : v;
+    return p;
+}
+
+int timing_parse_row(const char *p, const char *end, int32_t *l_idx, int64_t *t_ns) {
+    if (p < end && *p == '#') return 0;
+
+    // col1: frame index
+    p = skip_blanks(p, end);
+    int neg = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    const char *digits = p;
+    int64_t idx = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        idx = idx * 10 + (*p++ - '0');
+        if (idx > INT32_MAX) return 0;
+    }
+    if (p == digits || (p < end && !is_blank(*p))) return 0;
+
+    // col2..col4 are not used
+    for (int col = 2; col <= 4; col++) {
+        p = skip_blanks(p, end);
+        if (p == end) return 0;
+        p = skip_token(p, end);
+    }
+
+    // col5: acquisition time
+    p = skip_blanks(p, end);
+    if (p == end) return 0;
+    if (!parse_decimal_ns(p, end, t_ns)) {
+        // Not plain fixed-point: let strtod decide
+        char tok[64];
+        size_t n = (size_t)(skip_token(p, end) - p);
+        if (n >= sizeof(tok)) return 0;
+        memcpy(tok, p, n);
+        tok[n] = '\0';
+        char *tail;
+        double t = strtod(tok, &tail);
+        if (tail == tok || !isfinite(t)) return 0;
+        *t_ns = llround(t * 1e9);
+    }
+
+    *l_idx = (int32_t)(neg ? -idx : idx);
+    return 1;
+}
+
+int timing_last_row(const char *base, size_t len, int32_t *l_idx, int64_t *t_ns) {
+    size_t e = len;
+    while (e > 0) {
+        if (base[e - 1] == '\n') e--;
+        size_t b = e;
+        while (b > 0 && base[b - 1] != '\n') b--;
+        if (timing_parse_row(base + b, base + e, l_idx, t_ns)) return 1;
+        e = b;
+    }
+    return 0;
+}
+
+size_t timing_seek(const char *base, size_t len, int64_t t_ns, long *n_skipped) {
+    *n_skipped = 0;
+
+    // Header lines, then the length of the first row
+    size_t data_start = 0;
+    size_t row_len = 0;
+    for (size_t p = 0; p < len;) {
+        const char *nl = memchr(base + p, '\n', len - p);
+        if (!nl) break;
+        size_t n = (size_t)(nl - (base + p)) + 1;
+        if (base[p] != '#') {
+            data_start = p;
+            row_len = n;
+            break;
+        }
+        p += n;
+    }
+    if (row_len < 2 || (len - data_start) % row_len != 0) return 0;
+    long n_rows = (long)((len - data_start) / row_len);
+
+    // Largest row i with end time <= t_ns. Every probe must be a complete
+    // row of the same width that parses; rows 0 and i must be in order.
+    int32_t l_idx;
+    int64_t t, t_first = 0, t_found = 0;
+    long found = -1;
+    long lo = 0;
+    long hi = n_rows;
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        const char *row = base + data_start + (size_t)mid * row_len;
+        if (row[row_len - 1] != '\n' || memchr(row, '\n', row_len - 1)
+            || !timing_parse_row(row, row + row_len - 1, &l_idx, &t)) {
+            return 0;
+        }
+        if (t <= t_ns) {
+            found = mid;
+            t_found = t;
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (found <= 0) return 0;
+    if (!timing_parse_row(base + data_start, base + data_start + row_len - 1, &l_idx, &t_first)
+        || t_first > t_found) {
+        return 0;
+    }
+
+    *n_skipped = found;
+    return data_start + (size_t)found * row_len;
+}
+
+// Returns 0 on success, 1 if out of memory (rows is left unchanged)
+static int rows_append(TimingRows *rows, int32_t l_idx, int64_t t_ns) {
+    if (rows->n_rows == rows->cap) {
+        long cap = rows->cap ? 2 * rows->cap : 1024;
+        int32_t *l_idx_grown = (int32_t *)realloc(rows->l_idx, cap * sizeof(int32_t));
+        if (!l_idx_grown) return 1;
+        rows->l_idx = l_idx_grown;
+        int64_t *t_ns_grown = (int64_t *)realloc(rows->t_ns, cap * sizeof(int64_t));
+        if (!t_ns_grown) return 1;
+        rows->t_ns = t_ns_grown;
+        rows->cap = cap;
+    }
+    rows->l_idx[rows->n_rows] = l_idx;
+    rows->t_ns[rows->n_rows] = t_ns;
+    rows->n_rows++;
+    return 0;
+}
+
+// Map a timing file, or read it whole where it cannot be mapped. Returns 0
+// on success (base is NULL for an empty file), 1 if it cannot be read.
+static int map_timing_file(const char *path, char **base_out, size_t *len_out, int *mapped_out) {
+    *base_out = NULL;
+    *len_out = 0;
+    *mapped_out = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 1;
+    }
+    size_t len = (size_t)st.st_size;
+    if (len == 0) {
+        close(fd);
+        return 0;
+    }
+    char *base = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    int mapped = (base != MAP_FAILED);
+    if (!mapped) {
+        // File systems without mmap support: read it whole
+        base = (char *)malloc(len);
+        if (!base || pread(fd, base, len, 0) != (ssize_t)len) {
+            free(base);
+            close(fd);
+            return 1;
+        }
+    }
+    close(fd);
+
+    *base_out = base;
+    *len_out = len;
+    *mapped_out = mapped;
+    return 0;
+}
+
+static void unmap_timing_file(char *base, size_t len, int mapped) {
+    if (mapped) munmap(base, len);
+    else free(base);
+}
+
+int timing_file_summary(const char *path, int32_t *n_frames, int64_t *first_ns, int64_t *last_ns) {
+    char *base;
+    size_t len;
+    int mapped;
+    if (map_timing_file(path, &base, &len, &mapped) != 0 || !base) return 1;
+
+    // Only the pages holding the first and the last rows are read
+    int32_t first_idx = 0, last_idx = 0;
+    int found = 0;
+    for (size_t p = 0; p < len && !found;) {
+        const char *nl = memchr(base + p, '\n', len - p);
+        size_t e = nl ? (size_t)(nl - base) : len;
+        found = timing_parse_row(base + p, base + e, &first_idx, first_ns);
+        p = e + 1;
+    }
+    if (found) found = timing_last_row(base, len, &last_idx, last_ns);
+    unmap_timing_file(base, len, mapped);
+    if (!found) return 1;
+
+    *n_frames = last_idx - first_idx + 1;
+    return 0;
+}
+
+int timing_load_rows(const char *path, int64_t t_lo, int64_t t_hi, TimingRows *rows) {
+    memset(rows, 0, sizeof(*rows));
+
+    char *base;
+    size_t len;
+    int mapped;
+    if (map_timing_file(path, &base, &len, &mapped) != 0) return 1;
+    rows->file_bytes = len;
+    if (!base) return 0;
+
+    int32_t l_idx;
+    int64_t t_ns;
+    int err = 0;
+    if (timing_last_row(base, len, &l_idx, &t_ns) && t_ns <= t_lo) {
+        // Ends before the range: only the end of its last frame matters
+        err = rows_append(rows, l_idx, t_ns);
+        rows->tail_only = 1;
+    } else {
+        if (mapped) madvise(base, len, MADV_SEQUENTIAL);
+        const char *p = base + timing_seek(base, len, t_lo, &rows->n_skipped);
+        const char *end = base + len;
+        while (p < end) {
+            const char *nl = memchr(p, '\n', (size_t)(end - p));
+            const char *line_end = nl ? nl : end;
+            if (timing_parse_row(p, line_end, &l_idx, &t_ns)) {
+                if (rows_append(rows, l_idx, t_ns) != 0) {
+                    err = 1;
+                    break;
+                }
+                // The next frame would start at or after t_hi
+                if (t_ns >= t_hi) break;
+            }
+            p = nl ? nl + 1 : end;
+        }
+    }
+
+    unmap_timing_file(base, len, mapped);
+    if (err) {
+        fprintf(stderr, "Error: out of memory for the rows of %s\n", path);
+        timing_rows_free(rows);
+        return -1;
+    }
+    return 0;
+}
+
+void timing_rows_free(TimingRows *rows) {
+    free(rows->l_idx);
+    free(rows->t_ns);
+    memset(rows, 0, sizeof(*rows));
+}
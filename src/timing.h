@@ -0,0 +1,54 @@
+#ifndef MILK_RESAMPLE_TIMING_H
+#define MILK_RESAMPLE_TIMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "milkresample_export.h"
+
+// Timing files (<stream>_<time>.txt) written next to each telemetry cube:
+// '#' header lines, then one row per frame of whitespace-separated columns.
+// Only col1 (frame index within the cube) and col5 (acquisition time, Unix
+// seconds as a fixed-point decimal) are used.
+
+// Parse one row (without its newline). Returns 1 and sets l_idx and t_ns
+// (col5 in Unix ns, exact for up to 9 decimals) if it is a data row, 0 for
+// headers and malformed rows.
+MILKRESAMPLE_API int timing_parse_row(const char *p, const char *end, int32_t *l_idx, int64_t *t_ns);
+
+// Last data row of a file held in memory, found backwards from the end.
+// Returns 1 if there is one.
+MILKRESAMPLE_API int timing_last_row(const char *base, size_t len, int32_t *l_idx, int64_t *t_ns);
+
+// Offset of the last row ending at or before t_ns, found by bisection, so
+// that the rows before it need not be parsed. Rows must be fixed width with
+// increasing col5, as written by the logger; this is checked on every probe,
+// and 0 (read from the start) is returned if it does not hold.
+// n_skipped is set to the number of rows before the returned offset.
+MILKRESAMPLE_API size_t timing_seek(const char *base, size_t len, int64_t t_ns, long *n_skipped);
+
+// Frame count (from col1 of the first and last data rows) and end times of
+// the first and last frames of a file, reading only its first and last
+// rows. Returns 0 on success, 1 if it cannot be read or has no data row.
+MILKRESAMPLE_API int timing_file_summary(const char *path, int32_t *n_frames, int64_t *first_ns, int64_t *last_ns);
+
+// Rows of one timing file that matter for a range [t_lo, t_hi]: from the
+// last row ending at or before t_lo (which gives the start of the next
+// frame) to the first row ending at or after t_hi
+typedef struct {
+    int32_t *l_idx;         // col1 per row
+    int64_t *t_ns;          // col5 (frame end time, Unix ns) per row
+    long n_rows;
+    long cap;
+    long n_skipped;         // Rows before t_lo that were not parsed
+    int tail_only;          // The file ends at or before t_lo: only its last row
+    size_t file_bytes;      // Size of the file
+} TimingRows;
+
+// Map path and extract its rows for [t_lo, t_hi]. Independent calls may
+// run concurrently. Returns 0 on success, 1 if the file cannot be read,
+// -1 if out of memory (an error has been printed).
+MILKRESAMPLE_API int timing_load_rows(const char *path, int64_t t_lo, int64_t t_hi, TimingRows *rows);
+
+MILKRESAMPLE_API void timing_rows_free(TimingRows *rows);
+
+#endif
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "telemetry.h"
+#include "timing.h"
+#include "dayindex.h"
+#include "testutil.h"
+
+// Round trips of the day index: the index built for a copy of the sample
+// must describe every timing file as read directly, come back unchanged
+// when reopened, and follow files being added and removed.
+
+#define SNAME "apapane"
+#define DAY "20251106"
+
+// Check every entry of idx against the timing files of dirpath
+static void check_entries(const DayIndex *idx, const char *dirpath, double day_start) {
+    long n = idx->hdr->n_files;
+    for (long i = 0; i < n; i++) {
+        const DayIndexEntry *e = &idx->files[i];
+        const char *name = idx->names + e->name;
+        CHECK(fabs(e->tstart - (day_start + parse_filename_time(name))) < 1e-6);
+        if (i > 0) CHECK(e->tstart > idx->files[i - 1].tstart);
+
+        char path[2048];
+        snprintf(path, sizeof(path), "%s/%s", dirpath, name);
+        int32_t n_frames;
+        int64_t first_ns, last_ns;
+        CHECK(timing_file_summary(path, &n_frames, &first_ns, &last_ns) == 0);
+        if (i == n - 1) {
+            // The newest file may still grow
+            CHECK(e->n_frames == -1);
+        } else {
+            CHECK(e->n_frames == n_frames);
+            CHECK(e->first_ns == first_ns);
+            CHECK(e->last_ns == last_ns);
+        }
+    }
+}
+
+// Same files, with the same summaries
+static int same_index(const DayIndex *a, const DayIndex *b) {
+    if (a->hdr->n_files != b->hdr->n_files) return 0;
+    for (long i = 0; i < a->hdr->n_files; i++) {
+        const DayIndexEntry *ea = &a->files[i];
+        const DayIndexEntry *eb = &b->files[i];
+        if (strcmp(a->names + ea->name, b->names + eb->name) != 0 || ea->tstart != eb->tstart
+            || ea->n_frames != eb->n_frames || ea->first_ns != eb->first_ns || ea->last_ns != eb->last_ns) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Index of the file named name, -1 if absent
+static long find_name(const DayIndex *idx, const char *name) {
+    for (long i = 0; i < idx->hdr->n_files; i++) {
+        if (strcmp(idx->names + idx->files[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <telemetrysample>\n", argv[0]);
+        return 1;
+    }
+    char dir[1024];
+    if (test_tmpdir(dir, sizeof(dir)) != 0) return 1;
+    char teldir[1100];
+    snprintf(teldir, sizeof(teldir), "%s/tel", dir);
+    int n_copied = test_copy_stream(argv[1], teldir, DAY, SNAME);
+    CHECK(n_copied > 2);
+    char dirpath[1200];
+    snprintf(dirpath, sizeof(dirpath), "%s/%s/%s", teldir, DAY, SNAME);
+    double day_start = parse_time_arg("UT20251106T00:00:00", 0);
+
+    // Built from the directory
+    DayIndex idx;
+    CHECK(day_index_open(&idx, dirpath, SNAME, day_start, NULL) == 0);
+    if (!idx.hdr) {
+        test_remove_tree(dir);
+        return test_report("dayindex");
+    }
+    CHECK(idx.hdr->n_files == n_copied);
+    check_entries(&idx, dirpath, day_start);
+
+    // Written next to the stream directory
+    char index_path[1300];
+    snprintf(index_path, sizeof(index_path), "%s/%s/.%s.catalog", teldir, DAY, SNAME);
+    CHECK(access(index_path, F_OK) == 0);
+
+    // Reopened, and as listed without summaries
+    DayIndex again;
+    CHECK(day_index_open(&again, dirpath, SNAME, day_start, NULL) == 0);
+    if (again.hdr) {
+        CHECK(same_index(&idx, &again));
+        day_index_close(&again);
+    }
+    DayIndex listed;
+    CHECK(day_index_list(&listed, dirpath, SNAME, day_start) == 0);
+    if (listed.hdr) {
+        CHECK(listed.hdr->n_files == idx.hdr->n_files);
+        for (long i = 0; i < listed.hdr->n_files && i < idx.hdr->n_files; i++) {
+            CHECK(strcmp(listed.names + listed.files[i].name, idx.names + idx.files[i].name) == 0);
+            CHECK(listed.files[i].tstart == idx.files[i].tstart);
+            CHECK(listed.files[i].n_frames == -1);
+        }
+        day_index_close(&listed);
+    }
+
+    // Files starting at or before a time
+    CHECK(day_index_count_until(&idx, day_start) == 0);
+    CHECK(day_index_count_until(&idx, idx.files[0].tstart) == 1);
+    CHECK(day_index_count_until(&idx, idx.files[1].tstart - 1e-3) == 1);
+    CHECK(day_index_count_until(&idx, day_start + 86400) == n_copied);
+
+    // Remove a file and add a newer one: the former newest file gets its summary
+    char removed[256], newest[256], path[1600];
+    snprintf(removed, sizeof(removed), "%s", idx.names + idx.files[1].name);
+    snprintf(newest, sizeof(newest), "%s", idx.names + idx.files[idx.hdr->n_files - 1].name);
+    snprintf(path, sizeof(path), "%s/%s", dirpath, removed);
+    CHECK(unlink(path) == 0);
+    char *buf;
+    size_t len;
+    snprintf(path, sizeof(path), "%s/%s", dirpath, newest);
+    CHECK(test_read_file(path, &buf, &len) == 0);
+    snprintf(path, sizeof(path), "%s/%s_23:59:59.000000000.txt", dirpath, SNAME);
+    CHECK(test_write_file(path, buf, len) == 0);
+    free(buf);
+    day_index_close(&idx);
+
+    CHECK(day_index_open(&idx, dirpath, SNAME, day_start, NULL) == 0);
+    if (idx.hdr) {
+        CHECK(idx.hdr->n_files == n_copied);
+        CHECK(find_name(&idx, removed) < 0);
+        CHECK(find_name(&idx, newest) == n_copied - 2);
+        check_entries(&idx, dirpath, day_start);
+        day_index_close(&idx);
+    }
+
+    // A damaged index is rebuilt
+    CHECK(truncate(index_path, 100) == 0);
+    CHECK(day_index_open(&idx, dirpath, SNAME, day_start, NULL) == 0);
+    if (idx.hdr) {
+        CHECK(idx.hdr->n_files == n_copied);
+        check_entries(&idx, dirpath, day_start);
+        day_index_close(&idx);
+    }
+
+    test_remove_tree(dir);
+    return test_report("dayindex");
+}
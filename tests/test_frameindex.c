@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "telemetry.h"
+#include "timing.h"
+#include "dayindex.h"
+#include "frameindex.h"
+#include "testutil.h"
+
+// Round trip of the frame index: every frame of the timing files of a copy
+// of the sample must come back from the index, and ranges must select
+// frames like mkts: half-open, from the first frame ending after t0 to the
+// last frame starting before t1.
+
+#define SNAME "apapane"
+#define DAY "20251106"
+
+// Frames of the day, read directly from the timing files
+typedef struct {
+    int *file;
+    int32_t *l_idx;
+    int64_t *t_end;
+    long n;
+    char (*names)[256];
+    int n_files;
+} DayFrames;
+
+static int read_frames(const char *dirpath, double day_start, DayFrames *df) {
+    memset(df, 0, sizeof(*df));
+    DayIndex idx;
+    if (day_index_list(&idx, dirpath, SNAME, day_start) != 0) return 1;
+    df->n_files = (int)idx.hdr->n_files;
+    df->names = calloc((size_t)df->n_files, sizeof(*df->names));
+    long cap = 0;
+    for (int i = 0; i < df->n_files; i++) {
+        snprintf(df->names[i], sizeof(df->names[i]), "%s", idx.names + idx.files[i].name);
+        char path[2048];
+        snprintf(path, sizeof(path), "%s/%s", dirpath, df->names[i]);
+        TimingRows rows;
+        if (timing_load_rows(path, 0, INT64_MAX, &rows) != 0) return 1;
+        if (df->n + rows.n_rows > cap) {
+            cap = 2 * (df->n + rows.n_rows);
+            df->file = realloc(df->file, cap * sizeof(int));
+            df->l_idx = realloc(df->l_idx, cap * sizeof(int32_t));
+            df->t_end = realloc(df->t_end, cap * sizeof(int64_t));
+        }
+        for (long r = 0; r < rows.n_rows; r++) {
+            df->file[df->n] = i;
+            df->l_idx[df->n] = rows.l_idx[r];
+            df->t_end[df->n] = rows.t_ns[r];
+            df->n++;
+        }
+        timing_rows_free(&rows);
+    }
+    day_index_close(&idx);
+    return 0;
+}
+
+static void free_frames(DayFrames *df) {
+    free(df->file);
+    free(df->l_idx);
+    free(df->t_end);
+    free(df->names);
+}
+
+// Iterate over [t0, t1) and check that frames first .. first + n - 1 come back
+static void check_range(const char *teldir, const DayFrames *df, int64_t t0, int64_t t1, long first, long n) {
+    FrameIndexIter it;
+    FrameLocation loc;
+    frame_index_iter_init(&it, teldir, SNAME, t0, t1);
+    long k = first;
+    long n_bad = 0;
+    while (frame_index_iter_next(&it, &loc)) {
+        if (k >= first + n || k >= df->n) {
+            n_bad++;
+        } else if (strcmp(loc.name, df->names[df->file[k]]) != 0 || loc.l_idx != df->l_idx[k]
+                   || loc.t_end_ns != df->t_end[k] || loc.t_start_ns != (k > 0 ? df->t_end[k - 1] : 0)) {
+            n_bad++;
+        }
+        k++;
+    }
+    frame_index_iter_free(&it);
+    if (n_bad > 0 || k != first + n) {
+        fprintf(stderr, "range [%lld, %lld): %ld frames from %ld, expected %ld from %ld (%ld wrong)\n",
+                (long long)t0, (long long)t1, k - first, first, n, first, n_bad);
+    }
+    CHECK(n_bad == 0);
+    CHECK(k == first + n);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <telemetrysample>\n", argv[0]);
+        return 1;
+    }
+    char dir[1024];
+    if (test_tmpdir(dir, sizeof(dir)) != 0) return 1;
+    char teldir[1100];
+    snprintf(teldir, sizeof(teldir), "%s/tel", dir);
+    int n_copied = test_copy_stream(argv[1], teldir, DAY, SNAME);
+    CHECK(n_copied > 2);
+    char dirpath[1200];
+    snprintf(dirpath, sizeof(dirpath), "%s/%s/%s", teldir, DAY, SNAME);
+    double day_start = parse_time_arg("UT20251106T00:00:00", 0);
+
+    DayFrames df;
+    CHECK(read_frames(dirpath, day_start, &df) == 0);
+    CHECK(df.n > 3 * 1024);
+
+    int rebuilt = 0;
+    CHECK(frame_index_build(dirpath, SNAME, day_start, &rebuilt, NULL) == 0);
+    CHECK(rebuilt == 1);
+
+    FrameIndex fi;
+    CHECK(frame_index_open(&fi, dirpath, SNAME) == 0);
+    if (fi.hdr) {
+        CHECK(fi.hdr->n_files == n_copied);
+        CHECK(fi.hdr->n_frames == df.n);
+        CHECK(fi.hdr->first_ns == df.t_end[0]);
+        CHECK(fi.hdr->last_ns == df.t_end[df.n - 1]);
+        CHECK(fi.hdr->flags & FRAME_INDEX_MONOTONIC);
+        frame_index_close(&fi);
+    }
+
+    // The whole day
+    check_range(teldir, &df, df.t_end[0] - 1, df.t_end[df.n - 1] + 1, 0, df.n);
+
+    // Frame k runs from the end of frame k - 1 to its own end: across a
+    // block, at a block boundary and across a file boundary
+    long file_start = 0;
+    while (file_start < df.n && df.file[file_start] == 0) file_start++;
+    long ks[] = {1, 777, 1023, 1024, 1025, file_start - 1, file_start, file_start + 1, df.n - 2};
+    for (size_t i = 0; i < sizeof(ks) / sizeof(ks[0]); i++) {
+        long k = ks[i];
+        // Exactly the frame's own span: a frame ending at t0 is left out, and
+        // so is the next one, which starts at t1
+        check_range(teldir, &df, df.t_end[k - 1], df.t_end[k], k, 1);
+        check_range(teldir, &df, df.t_end[k - 1], df.t_end[k] + 1, k, 2);
+        // The frame live at an instant
+        check_range(teldir, &df, df.t_end[k] - 1, df.t_end[k], k, 1);
+        check_range(teldir, &df, df.t_end[k], df.t_end[k] + 1, k + 1, 1);
+    }
+    // Before the first frame ends, and after the last one
+    check_range(teldir, &df, df.t_end[0] - 1000, df.t_end[0] - 500, 0, 1);
+    check_range(teldir, &df, df.t_end[df.n - 1], df.t_end[df.n - 1] + 1000, 0, 0);
+
+    // Rebuilt when a newer file appears
+    char *buf;
+    size_t len;
+    char path[1600];
+    snprintf(path, sizeof(path), "%s/%s", dirpath, df.names[df.n_files - 1]);
+    CHECK(test_read_file(path, &buf, &len) == 0);
+    snprintf(path, sizeof(path), "%s/%s_23:59:59.000000000.txt", dirpath, SNAME);
+    CHECK(test_write_file(path, buf, len) == 0);
+    free(buf);
+    CHECK(frame_index_build(dirpath, SNAME, day_start, &rebuilt, NULL) == 0);
+    CHECK(rebuilt == 1);
+    CHECK(frame_index_open(&fi, dirpath, SNAME) == 0);
+    if (fi.hdr) {
+        CHECK(fi.hdr->n_files == n_copied + 1);
+        // The copy steps back in time
+        CHECK(!(fi.hdr->flags & FRAME_INDEX_MONOTONIC));
+        frame_index_close(&fi);
+    }
+
+    // Frames past t1 no longer end the range: the frame of the copy live at
+    // the same instant comes after the original one
+    long k = df.n - 2;
+    FrameIndexIter it;
+    FrameLocation loc;
+    long n_found = 0;
+    frame_index_iter_init(&it, teldir, SNAME, df.t_end[k] - 1, df.t_end[k]);
+    while (frame_index_iter_next(&it, &loc)) {
+        CHECK(loc.l_idx == df.l_idx[k] && loc.t_start_ns == df.t_end[k - 1] && loc.t_end_ns == df.t_end[k]);
+        n_found++;
+    }
+    frame_index_iter_free(&it);
+    CHECK(n_found == 2);
+
+    free_frames(&df);
+    test_remove_tree(dir);
+    return test_report("frameindex");
+}
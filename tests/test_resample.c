@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fitsio.h>
+#include "telemetry.h"
+#include "timing.h"
+#include "apply.h"
+#include "testutil.h"
+
+// The streaming ResampleContext must give the same planes as the FITS
+// resampler on the bundled sample. FITS cubes are generated next to its
+// timing files, with pixel values computed from the file name, the frame
+// index and the pixel, so that the context can be fed the same frames.
+
+#define SNAME "apapane"
+#define DAY "20251106"
+#define NX 5
+#define NY 3
+#define N_PIXELS (NX * NY)
+
+// Pixel p of frame l_idx of the cube of timing file name
+static float pixel_value(const char *name, int32_t l_idx, long p) {
+    unsigned h = 0;
+    for (const char *c = name; *c; c++) h = h * 31 + (unsigned char)*c;
+    return (float)((h % 97) + (l_idx % 1000) * 0.5 + p * 0.25);
+}
+
+static void make_frame(const char *name, int32_t l_idx, float *frame) {
+    for (long p = 0; p < N_PIXELS; p++) frame[p] = pixel_value(name, l_idx, p);
+}
+
+// Write the FITS cube of each timing file of the catalog. Returns 0 on success.
+static int write_cubes(const FileCatalog *cat) {
+    for (int i = 0; i < cat->count; i++) {
+        char path[MAX_PATH];
+        catalog_path(cat, i, path, sizeof(path));
+        int32_t n_frames;
+        int64_t first_ns, last_ns;
+        if (timing_file_summary(path, &n_frames, &first_ns, &last_ns) != 0) return 1;
+
+        char fits_path[MAX_PATH + 8];
+        snprintf(fits_path, sizeof(fits_path), "%.*s.fits", (int)(strlen(path) - 4), path);
+        const char *name = catalog_name(cat, i);
+        long naxes[3] = {NX, NY, n_frames};
+        float *cube = (float *)malloc((size_t)n_frames * N_PIXELS * sizeof(float));
+        if (!cube) return 1;
+        for (int32_t k = 0; k < n_frames; k++) make_frame(name, k, cube + (size_t)k * N_PIXELS);
+
+        fitsfile *fptr;
+        int status = 0;
+        long fpixel[3] = {1, 1, 1};
+        fits_create_file(&fptr, fits_path, &status);
+        fits_create_img(fptr, FLOAT_IMG, 3, naxes, &status);
+        fits_write_pix(fptr, TFLOAT, fpixel, (LONGLONG)n_frames * N_PIXELS, cube, &status);
+        fits_close_file(fptr, &status);
+        free(cube);
+        if (status) {
+            fits_report_error(stderr, status);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Read the resampled cube. Returns the number of planes, or -1 on error.
+static long read_cube(const char *path, float **data) {
+    fitsfile *fptr;
+    int status = 0;
+    long naxes[3] = {0, 0, 0};
+    fits_open_file(&fptr, path, READONLY, &status);
+    fits_get_img_size(fptr, 3, naxes, &status);
+    if (status || naxes[0] != NX || naxes[1] != NY) {
+        fits_report_error(stderr, status);
+        return -1;
+    }
+    *data = (float *)malloc((size_t)naxes[2] * N_PIXELS * sizeof(float));
+    long fpixel[3] = {1, 1, 1};
+    int anynul;
+    fits_read_pix(fptr, TFLOAT, fpixel, (LONGLONG)naxes[2] * N_PIXELS, NULL, *data, &anynul, &status);
+    fits_close_file(fptr, &status);
+    if (status) {
+        fits_report_error(stderr, status);
+        free(*data);
+        return -1;
+    }
+    return naxes[2];
+}
+
+// Compare one plane of the context with plane k of the cube
+static int plane_matches(const float *plane, const float *cube, long k) {
+    const float *ref = cube + (size_t)k * N_PIXELS;
+    for (long p = 0; p < N_PIXELS; p++) {
+        if (fabsf(plane[p] - ref[p]) > 1e-5f * fmaxf(1.0f, fabsf(ref[p]))) {
+            fprintf(stderr, "plane %ld pixel %ld: context %g, cube %g\n", k, p, plane[p], ref[p]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Feed the frames of the schedule to a context and compare its planes
+// with the resampled cube
+static void check_context(const ScheduleMap *sched, const float *cube, long n_out, int n_threads) {
+    ResampleContext *ctx = resample_context_create(N_PIXELS, n_out, n_threads);
+    CHECK(ctx != NULL);
+    if (!ctx) return;
+
+    float frame[N_PIXELS];
+    float plane[N_PIXELS];
+    long n_planes = 0;
+    long n_bad = 0;
+    long k;
+    ScheduleIter it;
+    ScheduleFrame f;
+    schedule_iter_init(&it, sched);
+    while (schedule_iter_next(&it, &f)) {
+        make_frame(sched->files[f.file_id].name, f.l_idx, frame);
+        CHECK(resample_context_add(ctx, frame, f.r_start, f.r_end) == 0);
+        while ((k = resample_context_next(ctx, plane)) >= 0) {
+            if (k != n_planes || k >= n_out || !plane_matches(plane, cube, k)) n_bad++;
+            n_planes++;
+        }
+    }
+    resample_context_finish(ctx);
+    while ((k = resample_context_next(ctx, plane)) >= 0) {
+        if (k != n_planes || k >= n_out || !plane_matches(plane, cube, k)) n_bad++;
+        n_planes++;
+    }
+    CHECK(n_bad == 0);
+    CHECK(n_planes == n_out);
+    CHECK(resample_context_late(ctx) == 0);
+    resample_context_destroy(ctx);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <telemetrysample>\n", argv[0]);
+        return 1;
+    }
+    char dir[1024];
+    if (test_tmpdir(dir, sizeof(dir)) != 0) return 1;
+    char teldir[1100];
+    snprintf(teldir, sizeof(teldir), "%s/tel", dir);
+    CHECK(test_copy_stream(argv[1], teldir, DAY, SNAME) > 0);
+    if (chdir(dir) != 0) return 1;
+
+    // Two seconds across a file boundary, as mkts would schedule them
+    double tstart = parse_time_arg("UT20251106T10:20:05", 0);
+    double tend = tstart + 2.0;
+    FileCatalog cat;
+    catalog_init(&cat);
+    CHECK(scan_files(teldir, SNAME, tstart, tend, 1, 1, &cat) == 0);
+    CHECK(cat.count >= 2);
+    CHECK(write_cubes(&cat) == 0);
+    CHECK(process_telemetry(&cat, SNAME, tstart, tend, 0.001, DEFAULT_JITTER, 1, 0, NULL, NULL) == 0);
+    catalog_free(&cat);
+
+    ScheduleMap sched;
+    CHECK(schedule_map_open(&sched, SNAME ".resample.bin") == 0);
+    if (!sched.hdr) {
+        test_remove_tree(dir);
+        return test_report("resample");
+    }
+
+    // Engine defaults, then threads and segments with synchronous I/O
+    ApplyOptions opt;
+    apply_default_options(&opt);
+    for (int run = 0; run < 2; run++) {
+        if (run == 1) {
+            opt.n_threads = 2;
+            opt.n_segments = 3;
+            opt.prefetch_depth = 0;
+            opt.write_depth = 0;
+            opt.block_frames = 7;
+        }
+        CHECK(apply_resample_file(SNAME ".resample.bin", teldir, "out.fits", &opt) == 0);
+        float *cube = NULL;
+        long n_out = read_cube("out.fits", &cube);
+        CHECK(n_out >= 1990 && n_out <= 2000);
+        if (n_out > 0) {
+            check_context(&sched, cube, n_out, run + 1);
+            free(cube);
+        }
+        unlink("out.fits");
+    }
+
+    schedule_map_close(&sched);
+    test_remove_tree(dir);
+    return test_report("resample");
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "schedule.h"
+#include "testutil.h"
+
+// Round trips of the binary schedule: frames written through the
+// ScheduleWriter must come back unchanged from the file and from memory,
+// and damaged schedules must be rejected.
+
+#define TSTART 1762424400.0
+#define DT 0.001
+#define N_FRAMES 2000
+
+static const char *const names[] = {"cam_10:20:00.000000000.txt", "cam_10:20:01.000000000.txt",
+                                    "cam_10:20:02.000000000.txt"};
+#define N_NAMES 3
+
+// Frames of three files: a regular clock, a file with jitter and a gap,
+// then a file with a different period and a skipped frame index
+static int make_frames(ScheduleFrame *frames, int64_t jitter_ns) {
+    int n = 0;
+    int64_t t = llround(TSTART * 1e9) - 5000000;    // Ideal end of the previous frame
+    int64_t prev_end = t;
+    for (int i = 0; i < N_FRAMES; i++) {
+        ScheduleFrame *f = &frames[n++];
+        memset(f, 0, sizeof(*f));
+        int file = i < 800 ? 0 : (i < 1500 ? 1 : 2);
+        int first = file == 0 ? 0 : (file == 1 ? 800 : 1500);
+        f->file_id = (uint32_t)file;
+        f->l_idx = i - first + (file == 2 && i >= 1700 ? 1 : 0);
+        if (i == 1200) {
+            // Gap: frames lost
+            t += 3000000;
+            prev_end = t;
+        }
+        f->t_start_ns = prev_end;
+        t += file == 2 ? 250000 : 400000;
+        f->t_end_ns = t + (file == 1 ? (i % 3 - 1) * jitter_ns : 0);
+        prev_end = f->t_end_ns;
+    }
+    return n;
+}
+
+// Compare the frames of a mapped schedule with the frames written. With a
+// jitter tolerance, end times may move by up to the tolerance.
+static void check_frames(const ScheduleMap *m, const ScheduleFrame *frames, int n, int64_t tol_ns) {
+    CHECK(m->hdr->n_files == N_NAMES);
+    CHECK(m->hdr->n_rows == n);
+    for (int i = 0; i < N_NAMES && i < m->hdr->n_files; i++) {
+        CHECK(strcmp(m->files[i].name, names[i]) == 0);
+    }
+
+    ScheduleIter it;
+    ScheduleFrame f;
+    schedule_iter_init(&it, m);
+    int k = 0;
+    int64_t prev_end = 0;
+    while (schedule_iter_next(&it, &f)) {
+        if (k >= n) {
+            k++;
+            continue;
+        }
+        const ScheduleFrame *e = &frames[k];
+        CHECK(f.file_id == e->file_id);
+        CHECK(f.l_idx == e->l_idx);
+        CHECK(llabs(f.t_end_ns - e->t_end_ns) <= tol_ns);
+        // A frame starts where the previous one ends, as fitted
+        if (k > 0 && e->t_start_ns == frames[k - 1].t_end_ns) CHECK(f.t_start_ns == prev_end);
+        else CHECK(f.t_start_ns == e->t_start_ns);
+        double r_end = (double)(f.t_end_ns - m->hdr->tstart_ns) * 1e-9 / DT;
+        CHECK(fabs(f.r_end - r_end) < 1e-9);
+        prev_end = f.t_end_ns;
+        k++;
+    }
+    CHECK(k == n);
+}
+
+// Write frames to path (NULL: memory), with the file table up front or
+// added file by file
+static int write_schedule(ScheduleWriter *w, const char *path, const ScheduleFrame *frames, int n, double jitter,
+                          int names_up_front) {
+    if (schedule_writer_open(w, path, names_up_front ? names : NULL, names_up_front ? N_NAMES : 0, TSTART, DT,
+                             jitter) != 0) {
+        return 1;
+    }
+    for (int i = 0; !names_up_front && i < N_NAMES; i++) {
+        if (schedule_writer_add_file(w, names[i]) != i) return 1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (schedule_writer_add(w, &frames[i]) != 0) return 1;
+    }
+    w->hdr.max_r_end = (double)(frames[n - 1].t_end_ns - w->hdr.tstart_ns) * 1e-9 / DT;
+    w->hdr.max_span = 1.0;
+    return schedule_writer_close(w);
+}
+
+// Write a damaged copy of the schedule in buf and check that it is rejected
+static void check_rejected(const char *dir, const char *what, const char *buf, size_t len) {
+    char path[1100];
+    snprintf(path, sizeof(path), "%s/%.32s.bin", dir, what);
+    CHECK(test_write_file(path, buf, len) == 0);
+    ScheduleMap m;
+    int ret = schedule_map_open(&m, path);
+    if (ret != -1) fprintf(stderr, "%s: schedule was not rejected\n", what);
+    CHECK(ret == -1);
+    if (ret == 0) schedule_map_close(&m);
+}
+
+int main(int argc, char *argv[]) {
+    (void)argc;
+    (void)argv;
+    char dir[1024];
+    if (test_tmpdir(dir, sizeof(dir)) != 0) return 1;
+
+    static ScheduleFrame frames[N_FRAMES];
+    int n = make_frames(frames, 0);
+
+    // Exact clocks, in memory
+    ScheduleWriter w;
+    ScheduleMap m;
+    CHECK(write_schedule(&w, NULL, frames, n, 0.0, 1) == 0);
+    CHECK(schedule_map_memory(&m, &w) == 0);
+    if (m.hdr) {
+        check_frames(&m, frames, n, 0);
+        // One segment per file, plus one for the gap and one for the skipped index
+        CHECK(m.hdr->n_clocks == 5);
+        schedule_map_close(&m);
+    }
+
+    // Same frames through a file, with the file table added as files come
+    char path[1100];
+    snprintf(path, sizeof(path), "%s/cam.resample.bin", dir);
+    CHECK(write_schedule(&w, path, frames, n, 0.0, 0) == 0);
+    CHECK(schedule_map_open(&m, path) == 0);
+    if (m.hdr) {
+        check_frames(&m, frames, n, 0);
+        CHECK(m.hdr->n_clocks == 5);
+        schedule_map_close(&m);
+    }
+
+    // Jitter below the tolerance does not split the clock segments
+    n = make_frames(frames, 300);
+    CHECK(write_schedule(&w, path, frames, n, 1e-6, 1) == 0);
+    CHECK(schedule_map_open(&m, path) == 0);
+    if (m.hdr) {
+        check_frames(&m, frames, n, 1000);
+        CHECK(m.hdr->n_clocks == 5);
+        schedule_map_close(&m);
+    }
+    // Without tolerance, every jittered frame starts a new segment
+    CHECK(write_schedule(&w, path, frames, n, 0.0, 1) == 0);
+    CHECK(schedule_map_open(&m, path) == 0);
+    if (m.hdr) {
+        check_frames(&m, frames, n, 0);
+        CHECK(m.hdr->n_clocks > 100);
+        schedule_map_close(&m);
+    }
+
+    // Damaged schedules
+    n = make_frames(frames, 0);
+    CHECK(write_schedule(&w, path, frames, n, 0.0, 1) == 0);
+    char *buf;
+    size_t len;
+    if (test_read_file(path, &buf, &len) == 0) {
+        ScheduleHeader *hdr = (ScheduleHeader *)buf;
+        ScheduleClock *clocks = (ScheduleClock *)(buf + sizeof(ScheduleHeader)
+                                                  + (size_t)hdr->n_files * sizeof(ScheduleFileEntry));
+        CHECK(hdr->n_clocks == 5);
+
+        check_rejected(dir, "truncated", buf, len - 1);
+
+        ScheduleClock saved = clocks[1];
+        clocks[1].file_id = (uint32_t)hdr->n_files;
+        check_rejected(dir, "file_id", buf, len);
+        clocks[1] = saved;
+
+        clocks[1] = clocks[2];
+        clocks[2] = saved;
+        check_rejected(dir, "unordered", buf, len);
+        clocks[2] = clocks[1];
+        clocks[1] = saved;
+
+        saved = clocks[3];
+        clocks[3].n_frames = 0;
+        check_rejected(dir, "empty", buf, len);
+        clocks[3] = saved;
+
+        hdr->n_rows++;
+        check_rejected(dir, "n_rows", buf, len);
+        hdr->n_rows--;
+
+        hdr->n_rows = -1;
+        check_rejected(dir, "incomplete", buf, len);
+        free(buf);
+    } else {
+        CHECK(!"schedule file readable");
+    }
+
+    test_remove_tree(dir);
+    return test_report("schedule");
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "telemetry.h"
+#include "timing.h"
+#include "testutil.h"
+
+// timing_seek on fixed-width rows, as written by the logger, and on ragged
+// rows, where it must fall back to reading from the start. timing_load_rows
+// must give the same rows in the window either way.
+
+#define N_ROWS 1000
+#define T0_NS 1762424400509419918LL
+#define PERIOD_NS 400123LL
+
+static int64_t row_time(long i) {
+    return T0_NS + i * PERIOD_NS;
+}
+
+// Timing file of N_ROWS rows. Fixed width pads the columns like the logger;
+// otherwise col1 is not padded and rows grow with its digits.
+static char *make_timing(int fixed, size_t *len) {
+    size_t cap = 256 + (size_t)N_ROWS * 128;
+    char *buf = (char *)malloc(cap);
+    size_t n = (size_t)snprintf(buf, cap, "# Telemetry stream timing data\n# col1 : datacube frame index\n"
+                                          "# col5 : Absolute time (acquisition)\n# \n");
+    for (long i = 0; i < N_ROWS; i++) {
+        int64_t t = row_time(i);
+        long long sec = t / 1000000000LL, frac = t % 1000000000LL;
+        n += (size_t)snprintf(buf + n, cap - n,
+                              fixed ? "%10ld %11ld %16.9f %21lld.%09lld %17lld.%09lld %12ld %12d\n"
+                                    : "%ld %11ld %16.9f %21lld.%09lld %17lld.%09lld %12ld %12d\n",
+                              i, 7196847 + i, i * 4e-4, sec, frac, sec, frac, 7196847 + i, 0);
+    }
+    *len = n;
+    return buf;
+}
+
+// Offset returned for row i, found by walking the lines: row 0 is read
+// from the start of the file
+static size_t row_offset(const char *buf, size_t len, long i) {
+    if (i == 0) return 0;
+    size_t p = 0;
+    while (p < len && buf[p] == '#') p = (size_t)((const char *)memchr(buf + p, '\n', len - p) - buf) + 1;
+    for (long k = 0; k < i; k++) p = (size_t)((const char *)memchr(buf + p, '\n', len - p) - buf) + 1;
+    return p;
+}
+
+static void check_seek_fixed(const char *buf, size_t len) {
+    long n_skipped;
+    // Before the first row, or on it: nothing to skip
+    CHECK(timing_seek(buf, len, row_time(0) - 1, &n_skipped) == 0 && n_skipped == 0);
+    CHECK(timing_seek(buf, len, row_time(0), &n_skipped) == 0 && n_skipped == 0);
+    long rows[] = {1, 2, 511, 512, 513, 998, 999};
+    for (size_t r = 0; r < sizeof(rows) / sizeof(rows[0]); r++) {
+        long i = rows[r];
+        // Last row ending at or before t: on a row, and just before the next
+        CHECK(timing_seek(buf, len, row_time(i), &n_skipped) == row_offset(buf, len, i));
+        CHECK(n_skipped == i);
+        CHECK(timing_seek(buf, len, row_time(i) + PERIOD_NS - 1, &n_skipped) == row_offset(buf, len, i));
+        CHECK(n_skipped == i);
+        CHECK(timing_seek(buf, len, row_time(i) - 1, &n_skipped) == row_offset(buf, len, i - 1));
+        CHECK(n_skipped == i - 1);
+    }
+    CHECK(timing_seek(buf, len, row_time(N_ROWS) + 1000000000LL, &n_skipped) == row_offset(buf, len, N_ROWS - 1));
+    CHECK(n_skipped == N_ROWS - 1);
+
+    // A truncated last row breaks the fixed width
+    CHECK(timing_seek(buf, len - 1, row_time(500), &n_skipped) == 0 && n_skipped == 0);
+}
+
+// Rows of a file on disk for [t_lo, t_hi]
+static int load_rows(const char *dir, const char *name, const char *buf, size_t len, int64_t t_lo, int64_t t_hi,
+                     TimingRows *rows) {
+    char path[1200];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if (test_write_file(path, buf, len) != 0) return 1;
+    memset(rows, 0, sizeof(*rows));
+    return timing_load_rows(path, t_lo, t_hi, rows);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <telemetrysample>\n", argv[0]);
+        return 1;
+    }
+    char dir[1024];
+    if (test_tmpdir(dir, sizeof(dir)) != 0) return 1;
+
+    size_t fixed_len, ragged_len;
+    char *fixed = make_timing(1, &fixed_len);
+    char *ragged = make_timing(0, &ragged_len);
+    check_seek_fixed(fixed, fixed_len);
+
+    // Ragged rows: read from the start
+    long n_skipped;
+    long rows[] = {1, 10, 100, 500, 999};
+    for (size_t r = 0; r < sizeof(rows) / sizeof(rows[0]); r++) {
+        CHECK(timing_seek(ragged, ragged_len, row_time(rows[r]), &n_skipped) == 0);
+        CHECK(n_skipped == 0);
+    }
+
+    // Rows for a window: from the row before it to the first row ending at
+    // or after its end. Ragged rows are read from the start, and end alike.
+    int64_t t_lo = row_time(300) + 5, t_hi = row_time(400) + 5;
+    TimingRows a, b;
+    CHECK(load_rows(dir, "cam_10:20:00.000000000.txt", fixed, fixed_len, t_lo, t_hi, &a) == 0);
+    CHECK(load_rows(dir, "cam_10:20:01.000000000.txt", ragged, ragged_len, t_lo, t_hi, &b) == 0);
+    CHECK(a.n_rows == 102 && a.n_skipped == 300);
+    CHECK(b.n_rows == 402 && b.n_skipped == 0);
+    for (long i = 0; i < a.n_rows && i + 300 < b.n_rows; i++) {
+        CHECK(a.l_idx[i] == 300 + i && b.l_idx[i + 300] == a.l_idx[i]);
+        CHECK(a.t_ns[i] == row_time(300 + i) && b.t_ns[i + 300] == a.t_ns[i]);
+    }
+    timing_rows_free(&a);
+    timing_rows_free(&b);
+    free(fixed);
+    free(ragged);
+
+    // A timing file of the sample, against a linear search of its rows
+    char path[2048];
+    snprintf(path, sizeof(path), "%s/20251106/apapane/apapane_10:20:00.509403978.txt", argv[1]);
+    char *buf;
+    size_t len;
+    CHECK(test_read_file(path, &buf, &len) == 0);
+    if (buf) {
+        int64_t first_ns = 0, last_ns = 0;
+        int32_t l_idx;
+        CHECK(timing_last_row(buf, len, &l_idx, &last_ns) == 1);
+        for (int k = 0; k <= 10; k++) {
+            // Rows ending at or before t, counted line by line
+            int64_t t = k == 0 ? 0 : first_ns + (last_ns - first_ns) / 10 * k;
+            long n_before = 0;
+            size_t last_off = 0;
+            for (size_t p = 0; p < len;) {
+                const char *nl = memchr(buf + p, '\n', len - p);
+                size_t end = nl ? (size_t)(nl - buf) : len;
+                int64_t t_row;
+                if (timing_parse_row(buf + p, buf + end, &l_idx, &t_row)) {
+                    if (k == 0 && first_ns == 0) first_ns = t_row;
+                    if (t_row <= t) {
+                        last_off = p;
+                        n_before++;
+                    }
+                }
+                p = end + 1;
+            }
+            size_t off = timing_seek(buf, len, t, &n_skipped);
+            if (n_before <= 1) {
+                CHECK(off == 0 && n_skipped == 0);
+            } else {
+                CHECK(off == last_off);
+                CHECK(n_skipped == n_before - 1);
+            }
+        }
+        free(buf);
+    }
+
+    test_remove_tree(dir);
+    return test_report("timing");
+}
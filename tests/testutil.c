@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "testutil.h"
+
+int test_failures = 0;
+
+int test_tmpdir(char *path, size_t size) {
+    const char *tmp = getenv("TMPDIR");
+    snprintf(path, size, "%s/milkresample-test-XXXXXX", tmp && tmp[0] ? tmp : "/tmp");
+    if (!mkdtemp(path)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char cache[1024];
+    snprintf(cache, sizeof(cache), "%s/cache", path);
+    setenv("MILK_RESAMPLE_CACHE", cache, 1);
+    return 0;
+}
+
+void test_remove_tree(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) != 0) return;
+    if (S_ISDIR(st.st_mode)) {
+        DIR *d = opendir(path);
+        if (d) {
+            struct dirent *de;
+            while ((de = readdir(d)) != NULL) {
+                if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+                char sub[2048];
+                snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+                test_remove_tree(sub);
+            }
+            closedir(d);
+        }
+        rmdir(path);
+    } else {
+        unlink(path);
+    }
+}
+
+int test_read_file(const char *path, char **buf, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return 1;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    *buf = (char *)malloc(n > 0 ? (size_t)n : 1);
+    if (!*buf || (n > 0 && fread(*buf, 1, (size_t)n, f) != (size_t)n)) {
+        free(*buf);
+        fclose(f);
+        return 1;
+    }
+    *len = (size_t)n;
+    fclose(f);
+    return 0;
+}
+
+int test_write_file(const char *path, const void *buf, size_t len) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return 1;
+    int ok = fwrite(buf, 1, len, f) == len;
+    return (fclose(f) == 0 && ok) ? 0 : 1;
+}
+
+int test_copy_stream(const char *sample, const char *teldir, const char *day, const char *sname) {
+    char src_dir[1024], dst_dir[1024];
+    snprintf(src_dir, sizeof(src_dir), "%s/%s/%s", sample, day, sname);
+    snprintf(dst_dir, sizeof(dst_dir), "%s/%s", teldir, day);
+    mkdir(teldir, 0755);
+    mkdir(dst_dir, 0755);
+    snprintf(dst_dir, sizeof(dst_dir), "%s/%s/%s", teldir, day, sname);
+    mkdir(dst_dir, 0755);
+
+    DIR *d = opendir(src_dir);
+    if (!d) {
+        fprintf(stderr, "Cannot open %s\n", src_dir);
+        return -1;
+    }
+    int n = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if (len < 4 || strcmp(de->d_name + len - 4, ".txt") != 0) continue;
+        char src[2048], dst[2048];
+        snprintf(src, sizeof(src), "%s/%s", src_dir, de->d_name);
+        snprintf(dst, sizeof(dst), "%s/%s", dst_dir, de->d_name);
+        char *buf;
+        size_t buf_len;
+        int err = test_read_file(src, &buf, &buf_len);
+        if (err == 0) {
+            err = test_write_file(dst, buf, buf_len);
+            free(buf);
+        }
+        if (err != 0) {
+            fprintf(stderr, "Cannot copy %s\n", src);
+            closedir(d);
+            return -1;
+        }
+        n++;
+    }
+    closedir(d);
+    return n;
+}
+
+int test_report(const char *name) {
+    if (test_failures > 0) {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, test_failures);
+        return 1;
+    }
+    printf("%s: all checks passed\n", name);
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef MILK_RESAMPLE_TESTUTIL_H
+#define MILK_RESAMPLE_TESTUTIL_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Helpers shared by the test programs. Each test takes the path of the
+// bundled telemetrysample/ directory as its argument, works on copies in a
+// temporary directory and exits with 0 if all checks passed.
+
+extern int test_failures;
+
+#define CHECK(cond)                                                                 \
+    do {                                                                            \
+        if (!(cond)) {                                                              \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                                        \
+        }                                                                           \
+    } while (0)
+
+// Create a temporary directory and point MILK_RESAMPLE_CACHE into it, so
+// that no index is written outside of it. Returns 0 on success.
+int test_tmpdir(char *path, size_t size);
+
+// Remove a directory tree
+void test_remove_tree(const char *path);
+
+// Copy the timing files of sample/day/sname to teldir/day/sname. Returns
+// the number of files copied, or -1 on error.
+int test_copy_stream(const char *sample, const char *teldir, const char *day, const char *sname);
+
+// Read a whole file into a heap buffer. Returns 0 on success.
+int test_read_file(const char *path, char **buf, size_t *len);
+
+// Write len bytes to path. Returns 0 on success.
+int test_write_file(const char *path, const void *buf, size_t len);
+
+// Report the result of the test. Returns the exit status.
+int test_report(const char *name);
+
+#endif